@@ -5,6 +5,8 @@
 #pragma GCC optimize("O0")
 
 intr_fn interrupts[8];
+// Nesting depth of interrupt handlers, 0 in thread context.
+volatile unsigned int intr_depth = 0;
 
 void init_interrupts()
 {
@@ -48,12 +50,14 @@ void do_interrupts(unsigned int status, unsigned int cause, context* pt_context)
 {
     int i;
     int index = cause >> 8;
+    ++intr_depth;
     for (i = 0; i < 8; i++) {
         if ((index & 1) && interrupts[i] != 0) {
             interrupts[i](status, cause, pt_context);
         }
         index >>= 1;
     }
+    --intr_depth;
 }
 
 void register_interrupt_handler(int index, intr_fn fn)
@@ -5,6 +5,7 @@
 typedef void (*intr_fn)(unsigned int, unsigned int, context*);
 
 extern intr_fn interrupts[8];
+extern volatile unsigned int intr_depth;
 
 void init_interrupts();
 int enable_interrupts();
@@ -4,6 +4,9 @@
 // sd driver: display hardware-related info
 // #define SD_DEBUG
 
+// sd driver: dma sectors straight into kernel buffers, pio through SD_BUF otherwise
+// #define SD_DMA
+
 // vga: calibrate vga output
 // #define VGA_CALIBRATE
 
@@ -16,6 +19,9 @@
 // slab: display debug info
 //#define SLAB_DEBUG
 
+// slab: catch double frees with a bitmap in each slab page
+// #define SLAB_DEBUG_FREE
+
 // myvi: display debug info
 // #define MYVI_DEBUG
 
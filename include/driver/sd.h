@@ -1,11 +1,50 @@
 #ifndef _DRIVER_SD_H
 #define _DRIVER_SD_H
 
+#include <xsu/list.h>
+#include <xsu/pc.h>
 #include <xsu/types.h>
 
 #define SECSIZE 512
 
+/* Asynchronous request, caller sleeps on done until sd interrupt completes it */
+struct sd_request {
+    int id;
+    int count;
+    void* buffer;
+    int write;
+    /* data moved by dma, no copy through SD_BUF */
+    int dma;
+    int result;
+    /* arrival order, used for deadline */
+    unsigned int seq;
+    /* next request served by the same command */
+    struct sd_request* merge_next;
+    struct semaphore done;
+    struct list_head list;
+};
+
+/* sd request queue counters */
+struct sd_stats {
+    /* requests queued */
+    u32 requests;
+    /* commands sent to card */
+    u32 dispatches;
+    /* requests appended to an adjacent one */
+    u32 merges;
+    /* reads served by an overlapping read */
+    u32 coalesced;
+    /* requests pending now, and the most seen */
+    u32 depth;
+    u32 max_depth;
+};
+
+extern struct sd_stats sd_stats;
+
 u32 sd_read_block(unsigned char* buf, unsigned long addr, unsigned long count);
 u32 sd_write_block(unsigned char* buf, unsigned long addr, unsigned long count);
+u32 sd_read_async(struct sd_request* req, unsigned char* buf, unsigned long addr, unsigned long count);
+u32 sd_wait(struct sd_request* req);
+void init_sd_async();
 
 #endif // ! _DRIVER_SD_H
\ No newline at end of file
@@ -27,6 +27,10 @@ struct page {
      * but if the page is part of a larger buddy's element(such as the second page), the orderlevel is -1 
      */
     unsigned int pageOrderLevel; 
+    /* page count of a contiguous range allocation, kept in its first page,
+     * 0 for blocks allocated by order
+     */
+    unsigned int contigPages;
 
 
     //unsigned int reference; 
@@ -35,14 +39,43 @@ struct page {
 #define PAGE_SHIFT 12
 /*
  * order means the size of the set of pages, e.g. order = 1 -> 2^1
- * pages(consequent) are free In current system, we allow the max order to be
- * 4(2^4 consequent free pages)
+ * pages(consequent) are free. The max order can be set at build time, it is
+ * 10 by default (2^10 consequent free pages, 4MB) and cannot be less.
+ * Larger buffers come from alloc_contig_pages.
  */
-#define MAX_BUDDY_ORDER 4
+#ifndef MAX_BUDDY_ORDER
+#define MAX_BUDDY_ORDER 10
+#endif
+#if MAX_BUDDY_ORDER < 10
+#error "MAX_BUDDY_ORDER must be at least 10"
+#endif
 
 struct FreeList {
     unsigned int freeNumer;
     struct list_head freeHead;
+    /* one bit per block of this order, set while the block is in freeHead */
+    unsigned int* freeMap;
+};
+
+/*
+ * order-0 pages cached in front of the buddy lock, one list per cpu and per
+ * context (thread, interrupt). All threads share the thread list and can be
+ * preempted, so interrupts are masked while a list changes. Hot pages (just freed) are at the head, cold
+ * pages (refilled from buddy) at the tail. A list is refilled and drained
+ * PCP_BATCH pages at a time, and drained once it holds PCP_HIGH pages.
+ */
+#ifndef NR_CPUS
+#define NR_CPUS 1
+#endif
+#define PCP_CONTEXTS 2
+#ifndef PCP_HIGH
+#define PCP_HIGH 32
+#endif
+#define PCP_BATCH 8
+
+struct per_cpu_pages {
+    unsigned int count;
+    struct list_head list;
 };
 
 struct buddy_sys {
@@ -51,6 +84,7 @@ struct buddy_sys {
     struct page* startPagePtr;
     struct lock_t buddyLock;
     struct FreeList freeList[MAX_BUDDY_ORDER + 1];
+    struct per_cpu_pages pcp[NR_CPUS][PCP_CONTEXTS];
 };
 // two page is in the same level, in other words in the same group
 //#define _is_same_bpgroup(firstPage, secondPage) (((*(firstPage)).pageOrderLevel == (*(secondPage)).pageOrderLevel))
@@ -81,6 +115,13 @@ extern void free_pages(void* addr, unsigned int order);
 
 extern void* alloc_pages(unsigned int order);
 
+extern void __free_contig_pages(struct page* page, unsigned int count);
+extern struct page* __alloc_contig_pages(unsigned int count);
+
+extern void free_contig_pages(void* addr, unsigned int count);
+
+extern void* alloc_contig_pages(unsigned int count);
+
 extern void init_buddy();
 
 extern void buddy_info();
@@ -0,0 +1,47 @@
+#ifndef _XSU_FS_DCACHE_H
+#define _XSU_FS_DCACHE_H
+
+#include <xsu/types.h>
+
+/*
+ * Path resolution cache.
+ *
+ * Maps a filesystem path (without device prefix) to the location of its
+ * directory entry on the device, or remembers that the path does not
+ * exist. Names are compared without case, as on FAT volumes.
+ *
+ *    dcache_lookup   - find path, returns DCACHE_MISS, DCACHE_HIT (LOC
+ *                      filled in) or DCACHE_NEGATIVE
+ *    dcache_enter    - remember path, LOC NULL for a negative entry
+ *    dcache_drop_negative - forget negative entries, after a create
+ *    dcache_drop_loc - forget entries at a directory entry, after a remove
+ *    dcache_flush    - forget everything
+ */
+
+#define DCACHE_MISS 0
+#define DCACHE_HIT 1
+#define DCACHE_NEGATIVE 2
+
+/* Number of cached paths */
+#define DCACHE_NUM 64
+/* Longer paths are not cached */
+#define DCACHE_PATH_LEN 64
+/* Hash buckets, must be power of 2 */
+#define DCACHE_HASH_NUM 32
+
+struct dentry_loc {
+    /* sector holding the directory entry */
+    unsigned long sector;
+    /* byte offset of the entry in sector */
+    unsigned long offset;
+    /* first cluster of parent directory */
+    unsigned long dir_clus;
+};
+
+int dcache_lookup(const char* path, struct dentry_loc* loc);
+void dcache_enter(const char* path, const struct dentry_loc* loc);
+void dcache_drop_negative(void);
+void dcache_drop_loc(unsigned long sector, unsigned long offset);
+void dcache_flush(void);
+
+#endif
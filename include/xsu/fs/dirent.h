@@ -0,0 +1,32 @@
+#ifndef _XSU_FS_DIRENT_H
+#define _XSU_FS_DIRENT_H
+
+#include <xsu/types.h>
+
+/*
+ * Directory entry as returned by VOP_GETDIRENTRY.
+ *
+ * A call fills the uio buffer with as many records as fit. Records have
+ * variable length: only d_reclen bytes of each are stored, and the next
+ * record follows right after. The uio offset is a cookie of the
+ * filesystem, pass it back unchanged to continue, or 0 to restart. A call
+ * that moves no data means the end of the directory.
+ */
+
+#define DIRENT_NAME_MAX 255
+
+struct dirent {
+    uint16_t d_reclen; /* Length of this record */
+    uint8_t d_namlen; /* Length of name, without terminating 0 */
+    uint8_t d_attr; /* FAT attribute bits */
+    uint32_t d_size; /* File size (in bytes) */
+    uint16_t d_date; /* Last modify date */
+    uint16_t d_time; /* Last modify time */
+    char d_name[DIRENT_NAME_MAX + 1];
+};
+
+/* Record length for a name, keeps following records word aligned */
+#define DIRENT_HEADER_SIZE 12
+#define DIRENT_RECLEN(namlen) ((DIRENT_HEADER_SIZE + (namlen) + 1 + 3) & ~3)
+
+#endif
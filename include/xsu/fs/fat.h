@@ -8,12 +8,12 @@
 #include <xsu/fs/vnode.h>
 #include <xsu/types.h>
 
-/* 4k data buffer number in each file struct */
-#define LOCAL_DATA_BUF_NUM 4
-
 #define SECTOR_SIZE 512
 #define CLUSTER_SIZE 4096
 
+/* cluster runs cached in each file struct */
+#define FILE_EXTENT_NUM 8
+
 struct __attribute__((__packed__)) dir_entry_attr {
     uint8_t name[8]; /* Name */
     uint8_t ext[3]; /* Extension */
@@ -35,6 +35,25 @@ union dir_entry {
     struct dir_entry_attr attr;
 };
 
+/* physically contiguous run of clusters in a file */
+struct fat_extent {
+    /* first logical cluster in file */
+    unsigned long logical;
+    /* first data cluster on disk */
+    unsigned long start;
+    /* number of clusters in run */
+    unsigned long len;
+};
+
+/* long name entries in front of a directory entry */
+struct lfn_loc {
+    /* first long name entry */
+    unsigned long sector;
+    unsigned long offset;
+    /* number of long name entries, 0 if entry has no long name */
+    unsigned long num;
+};
+
 /* file struct */
 typedef struct fat_file {
     unsigned char path[256];
@@ -43,15 +62,26 @@ typedef struct fat_file {
     /* Current directory entry position */
     unsigned long dir_entry_pos;
     unsigned long dir_entry_sector;
+    /* First cluster of parent directory */
+    unsigned long dir_clus;
     /* current directory entry */
     union dir_entry entry;
-    /* Buffer clock head */
-    unsigned long clock_head;
-    /* For normal FAT32, cluster size is 4k */
-    BUF_4K data_buf[LOCAL_DATA_BUF_NUM];
+    /* long name of current directory entry */
+    struct lfn_loc lfn;
+    /* Read-ahead: last logical cluster touched by fs_read */
+    unsigned long ra_next;
+    /* Read-ahead: first logical cluster not prefetched yet */
+    unsigned long ra_limit;
+    /* Read-ahead: window in clusters, 0 when access is not sequential */
+    unsigned long ra_window;
+    /* Logical to data cluster map, built lazily along the chain */
+    struct fat_extent extent[FILE_EXTENT_NUM];
+    unsigned long extent_num;
 } FILE;
 
 typedef struct fs_fat_dir {
+    /* First sector of directory */
+    unsigned long start_sector;
     unsigned long cur_sector;
     unsigned long loc;
     unsigned long sec;
@@ -103,6 +133,8 @@ union BPB_info {
 struct fs_info {
     uint32_t base_addr;
     uint32_t sectors_per_fat;
+    /* FAT copy used for reads and writes, from BPB flags */
+    uint32_t active_fat;
     uint32_t total_sectors;
     uint32_t total_data_clusters;
     uint32_t total_data_sectors;
@@ -121,13 +153,20 @@ unsigned long fs_find(FILE* file);
 unsigned long init_fs();
 // open file.
 unsigned long fs_open(FILE* file, unsigned char* filename);
+// open file at a directory entry found by path cache.
+struct dentry_loc;
+unsigned long fs_open_at(FILE* file, unsigned char* filename, const struct dentry_loc* loc);
 // close file.
 unsigned long fs_close(FILE* file);
 // read file.
 unsigned long fs_read(FILE* file, unsigned char* buf, unsigned long count);
 // write file.
 unsigned long fs_write(FILE* file, const unsigned char* buf, unsigned long count);
+// copy content of an open file into another.
+unsigned long fs_copy(FILE* dst, FILE* src);
 unsigned long fs_fflush();
+// write dirty buffers back in background, run as kernel thread.
+void fs_flusher();
 void fs_lseek(FILE* file, unsigned long new_loc);
 // create file.
 unsigned long fs_create(unsigned char* filename);
@@ -143,11 +182,18 @@ unsigned long fs_cp(unsigned char* src, unsigned char* dest);
 unsigned long fs_open_dir(FS_FAT_DIR* dir, unsigned char* filename);
 // read dir.
 unsigned long fs_read_dir(FS_FAT_DIR* dir, unsigned char* buf);
+// read many decoded dir entries at uio offset.
+struct uio;
+unsigned long fs_read_dirents(FS_FAT_DIR* dir, struct uio* uio);
 // cat.
 unsigned long fs_cat(unsigned char* path);
 void get_filename(unsigned char* entry, unsigned char* buf);
 uint32_t read_block(uint8_t* buf, uint32_t addr, uint32_t count);
 uint32_t write_block(uint8_t* buf, uint32_t addr, uint32_t count);
+// start a read without waiting, collect it with wait_block.
+struct sd_request;
+uint32_t read_block_async(struct sd_request* req, uint8_t* buf, uint32_t addr, uint32_t count);
+uint32_t wait_block(struct sd_request* req);
 uint32_t get_entry_filesize(uint8_t* entry);
 uint32_t get_entry_attr(uint8_t* entry);
 
@@ -3,24 +3,73 @@
 
 #include <xsu/types.h>
 
+/* Number of cluster buffers shared by all open files */
+#ifndef FSCACHE_4K_NUM
+#define FSCACHE_4K_NUM 32
+#endif
+
+/* Number of hash buckets for cluster lookup, must be power of 2 */
+#define FSCACHE_4K_HASH_NUM 64
+
+/* Flusher thread wakes up every FS_FLUSH_INTERVAL ms */
+#ifndef FS_FLUSH_INTERVAL
+#define FS_FLUSH_INTERVAL 1000
+#endif
+
+/* Dirty clusters older than FS_DIRTY_AGE ms are written back by flusher */
+#ifndef FS_DIRTY_AGE
+#define FS_DIRTY_AGE 3000
+#endif
+
+/* FAT copies are brought up to date with the active FAT every FS_MIRROR_INTERVAL ms */
+#ifndef FS_MIRROR_INTERVAL
+#define FS_MIRROR_INTERVAL 30000
+#endif
+
+/* All dirty clusters are written back once they take this percent of cache */
+#ifndef FS_DIRTY_RATIO
+#define FS_DIRTY_RATIO 50
+#endif
+
+/* Staging buffer for merging adjacent dirty clusters into one sd write */
+#define FS_FLUSH_BUF_SIZE 32768
+
 /* 4k byte buffer */
 typedef struct buf_4k {
-    unsigned char buf[4096];
+    /* cluster data, allocated from buddy when fs inits */
+    unsigned char* buf;
     unsigned long cur;
+    /* bit 0 referenced, bit 1 dirty, bit 2 being written by flusher,
+     * bit 3 read-ahead in flight */
     unsigned long state;
+    /* next buffer index in the same hash bucket */
+    unsigned long hash_next;
+    /* flusher pass in which buffer became dirty */
+    unsigned long dirty_epoch;
 } BUF_4K;
 
 /* 512 byte buffer */
 typedef struct buf_512 {
     unsigned char buf[512];
     unsigned long cur;
+    /* same bits as in BUF_4K */
     unsigned long state;
 } BUF_512;
 
+/* Global cluster cache */
+extern BUF_4K fscache_4k[FSCACHE_4K_NUM];
+
+uint32_t init_fscache_4k();
 uint32_t fs_victim_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size);
 uint32_t fs_write_4k(BUF_4K* f);
-uint32_t fs_read_4k(BUF_4K* f, uint32_t FirstSectorOfCluster, uint32_t* clock_head, uint32_t size);
-uint32_t fs_clr_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size, uint32_t cur);
+uint32_t fs_read_4k(uint32_t FirstSectorOfCluster);
+uint32_t fs_lookup_4k(uint32_t FirstSectorOfCluster);
+uint32_t fs_prefetch_4k(uint32_t FirstSectorOfCluster);
+uint32_t fs_clr_4k(uint32_t FirstSectorOfCluster, uint32_t start, uint32_t end);
+uint32_t fs_copy_4k(uint32_t SrcSectorOfCluster, uint32_t DstSectorOfCluster);
+uint32_t fs_fflush_4k();
+void fs_dirty_4k(uint32_t index);
+uint32_t fs_flush_4k(uint32_t all);
 
 uint32_t fs_victim_512(BUF_512* buf, uint32_t* clock_head, uint32_t size);
 uint32_t fs_write_512(BUF_512* f);
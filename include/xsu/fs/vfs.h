@@ -92,11 +92,16 @@ int vfs_lookparent(char* path, struct vnode** result, char* buf, size_t buflen);
  *    vfs_chdir  - Change current directory of current thread by name.
  *    vfs_getcwd - Retrieve name of current directory of current thread.
  *
- *    vfs_close  - Close a vnode opened with vfs_open. Does not fail.
+ *    vfs_close  - Close a vnode opened with vfs_open and free it. Does not fail.
  *                 (See vfspath.c for a discussion of why.)
+ *
+ *    vfs_opendir  - Open a directory, read it with VOP_GETDIRENTRY.
+ *    vfs_closedir - Close a vnode opened with vfs_opendir and free it.
  */
 int vfs_open(char* path, int openflags, mode_t mode, struct vnode** ret);
 void vfs_close(struct vnode* vn);
+int vfs_opendir(char* path, struct vnode** ret);
+void vfs_closedir(struct vnode* vn);
 int vfs_readlink(char* path, struct uio* data);
 int vfs_symlink(const char* contents, char* path);
 int vfs_mkdir(char* path, mode_t mode);
@@ -116,7 +121,7 @@ int vfs_getcwd(struct uio* buf);
  * Misc
  *
  *    vfs_bootstrap - Call during system initialization to allocate 
- *                    structures.
+ *                    structures, including the slab caches below.
  *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
@@ -158,6 +163,13 @@ int vfs_getcwd(struct uio* buf);
  */
 
 void vfs_bootstrap(void);
+
+/* Slab caches of vnodes and of open FAT files and directories */
+struct kmem_cache;
+extern struct kmem_cache* vnode_cache;
+extern struct kmem_cache* fat_file_cache;
+extern struct kmem_cache* fat_dir_cache;
+
 int vfs_setbootfs(const char* fsname);
 
 int vfs_adddev(const char* devname, struct device* dev, int mountable);
@@ -135,6 +135,12 @@ typedef struct {
 // The current running task
 extern task_struct* current;
 
+// Slab caches of task unions, vma nodes and page tables
+struct kmem_cache;
+extern struct kmem_cache* task_union_cache;
+extern struct kmem_cache* vma_node_cache;
+extern struct kmem_cache* pgtable_cache;
+
 // Task struct with it's stack
 typedef union {
     task_struct task;
@@ -148,6 +154,11 @@ struct semaphore {
     int count;
 };
 
+struct semaphore* create_semaphore(char* name, int count);
+void release_semaphore(struct semaphore* sem);
+void sem_wait(struct semaphore* sem);
+void sem_signal(struct semaphore* sem);
+
 // Init,create,kill
 void init_pc();
 void pc_create(void (*func)(), char* name);
@@ -239,6 +250,8 @@ void syscall_fork(unsigned int status, unsigned int cause, context* pt_context);
 void syscall_sleep(unsigned int status, unsigned int cause, context* pt_context);
 // wait:blocked entil task a0 ends 
 void syscall_wait(unsigned int status, unsigned int cause, context* pt_context);
+// sem_wait: take semaphore a0, block until it is signaled if not available
+void syscall_sem_wait(unsigned int status, unsigned int cause, context* pt_context);
 
 // Call a syscall with code in v0 and parameter a0
 int call_syscall_a0(int code,int a0);
@@ -8,43 +8,65 @@
 #define SLAB_AVAILABLE 0x0
 #define SLAB_USED 0xff
 
+/* pages a cache keeps on its partial list, a page that becomes completely
+ * free is given back to buddy only while the list holds more than this
+ */
+#define SLAB_MIN_PARTIAL 2
+
+/* most objects one page can hold, each object is at least one word */
+#define SLAB_MAX_OBJECTS ((1 << PAGE_SHIFT) / SIZE_INT)
+
 /*
- * slab_head makes the allocation accessible from listTailPtr to the end of the page
- * @listTailPtr : points to tail of the page's slab element list
- * @allocatedNumber : keeps the numbers of memory segments that has been allocated
+ * slab_head sits at the start of every slab page
+ * @freeList : first free object of the page, free objects are linked in LIFO
+ * order through the word at cache->offset, 0 when the page is full
+ * @allocatedNumber : keeps the numbers of objects that has been allocated
+ * @freeMap : one bit per object, set while the object is free, catches
+ * double frees (SLAB_DEBUG_FREE only)
  */
 struct slab_head {
-    void* listTailPtr;
+    void* freeList;
     unsigned int allocatedNumber;
+#ifdef SLAB_DEBUG_FREE
+    unsigned int freeMap[SLAB_MAX_OBJECTS / 32];
+#endif
 };
 
 /*
  * this is the slab control block, record the information and control the slub' allocation
  * each slub contains a kmem_cache_node
- * @partial keeps the list of un-totally-allocated slub element
- * @full keeps the list of totally-allocated slub element
+ * @partial keeps the pages with free objects, allocation takes them from the head
+ * @full keeps the totally-allocated pages
+ * @partialNumber : the number of pages on partial
  */
 struct kmem_cache_node {
     struct list_head partial;
     struct list_head full;
+    unsigned int partialNumber;
 };
 
 /*
- * current being allocated page unit
- * @cpuFreeObjectPtr: points to the free-space head addr inside current page
+ * current being allocated page unit, it is on neither list of the node
  * @page: points to the current page(which is being allocated!)
  */
 struct kmem_cache_cpu {
-    // attention, it is a two-level pointer
-    void** cpuFreeObjectPtr; 
     struct page* page;
 };
 /*
  * this is the slab information block, record the information of every single slub system
  * each slub contains a kmem_cache
- * @objectSize: input parameters, such as 8, 16, 32....., but it doesn't means the really allocated size
- * @size: the real allocated size, contains the memory(allocated to user) and the pointers(user cannot access)
- * @offset: pointer's offset in slub element
+ * @objectSize: input parameters, such as 8, 16, 32....., rounded up to words
+ * @size: the real allocated size, the distance between two objects in a page
+ * @offset: offset of the free list link in a free object, past the object
+ * when the cache has a constructor so constructed state survives a free
+ * @objectNumber: objects in one page, 0 when every object is a whole buddy
+ * block of the cache's order (objects too large to share a page)
+ * @align: objects start at a multiple of align
+ * @order: buddy order of one object when objectNumber is 0
+ * @ctor: called once on each object when its memory comes from buddy, a
+ * freed object must be left in constructed state, 0 for none
+ * @pageNumber: pages the cache holds, @inUse: objects handed out
+ * @list: link in the list of all caches
  * @name: this slub element's name
  */
 
@@ -52,6 +74,13 @@ struct kmem_cache {
     unsigned int size;
     unsigned int objectSize;
     unsigned int offset;
+    unsigned int objectNumber;
+    unsigned int align;
+    unsigned int order;
+    void (*ctor)(void* object);
+    unsigned int pageNumber;
+    unsigned int inUse;
+    struct list_head list;
     struct kmem_cache_node node;
     struct kmem_cache_cpu cpu;
     unsigned char name[16];
@@ -62,4 +91,11 @@ extern void init_slab();
 extern void* kmalloc(unsigned int size);
 extern void kfree(void* obj);
 extern void kmemtop();
+
+// dedicated cache for one kind of object, align must be a power of two
+extern struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align, void (*ctor)(void*));
+extern void* kmem_cache_alloc(struct kmem_cache* cache);
+extern void kmem_cache_free(struct kmem_cache* cache, void* obj);
+// print memory held by every cache
+extern void kmem_cache_info();
 #endif
@@ -71,4 +71,10 @@ void lock_release(struct lock*);
 bool lock_do_i_hold(struct lock*);
 void lock_destroy(struct lock*);
 
+/*
+ * Create the slab caches locks and wait channels come from. Called once
+ * at boot, after the slab allocator and before any lock is created.
+ */
+void synch_bootstrap(void);
+
 #endif
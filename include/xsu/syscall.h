@@ -21,5 +21,6 @@ void register_syscall(int index, sys_fn fn);
 #define SYSCALL_FORK 8
 #define SYSCALL_SLEEP 9
 #define SYSCALL_WAIT 10
+#define SYSCALL_SEM_WAIT 11
 
 #endif
@@ -5,14 +5,22 @@
 
 #define container_of(ptr, type, member) ((type*)((char*)ptr - (char*)&(((type*)0)->member)))
 
+/* Cache line size, memory functions copy one line per loop iteration */
+#define KERNEL_CACHE_LINE 32
+
 /*
  * C memory functions. 
+ *
+ * kernel_clear_page and kernel_copy_page work on a whole page and need
+ * word aligned pointers.
  */
 void* kernel_memcpy(void* dst, void* src, int len);
 void* kernel_memset(void* dst, int b, int len);
 void* kernel_memmove(void* dst, void* src, size_t len);
 unsigned int* kernel_memset_word(unsigned int* dst, unsigned int w, int len);
 void bzero(void* vblock, size_t len);
+void kernel_clear_page(void* page);
+void kernel_copy_page(void* dst, void* src);
 
 /*
  * C string functions.
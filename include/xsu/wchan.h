@@ -42,6 +42,12 @@ struct wchan {
     struct lock_t wc_lock; // Lock for mutual exclusion.
 };
 
+/*
+ * Create the slab cache wait channels come from. Called once at boot,
+ * before any wait channel is created.
+ */
+void wchan_bootstrap(void);
+
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
  * NAME should be a string constant; if not, the caller is responsible
@@ -1,6 +1,8 @@
 #include "sd.h"
 #include <driver/vga.h>
 #include <intr.h>
+#include <xsu/list.h>
+#include <xsu/pc.h>
 
 #pragma GCC push_opitons
 #pragma GCC optimize("O0")
@@ -8,6 +10,52 @@
 static volatile unsigned int* const SD_CTRL = (unsigned int*)0xbfc09100;
 static volatile unsigned int* const SD_BUF = (unsigned int*)0xbfc08000;
 
+// Command register: index in [13:8], data direction in [6:5], idx/crc/busy checks, R1 response
+#define SD_CMD_STOP_TRANSMISSION 0x0c1d
+#define SD_CMD_READ_SINGLE_BLOCK 0x1139
+#define SD_CMD_READ_MULTIPLE_BLOCK 0x1239
+#define SD_CMD_WRITE_BLOCK 0x1859
+#define SD_CMD_WRITE_MULTIPLE_BLOCK 0x1959
+
+// SD_BUF window is 4K, so one transfer moves at most 8 sectors
+#define SD_BUF_SECTORS 8
+
+// Interrupt line of sd controller, data events: transfer done, crc error, fifo error
+#define SD_IRQ 3
+#define SD_DATA_INT_MASK 0x7
+
+// Pending requests older than this many arrivals are served before others
+#define SD_FIFO_EXPIRE 8
+
+// Pending requests sorted by sector, sd_active is the batch on the card
+static struct list_head sd_queue;
+static struct sd_request* sd_active = 0;
+static int sd_active_start = 0;
+static int sd_active_count = 0;
+static int sd_async = 0;
+// Elevator position: first sector after last dispatched batch
+static int sd_head = 0;
+static unsigned int sd_seq = 0;
+
+struct sd_stats sd_stats;
+
+// Point controller at buffer for dma, return 1 if done, 0 if data has to be
+// copied through SD_BUF by cpu
+static int sd_set_dma(void* buffer)
+{
+#ifdef SD_DMA
+    unsigned int addr = (unsigned int)buffer;
+    // Only unmapped kernel segments are physically contiguous
+    if ((addr & 3) == 0 && addr >= 0x80000000 && addr < 0xc0000000) {
+        SD_CTRL[24] = addr & 0x1fffffff;
+        return 1;
+    }
+#endif
+    // Set dma_address to SD_BUF
+    SD_CTRL[24] = 0;
+    return 0;
+}
+
 static int sd_send_cmd_blocking(int cmd, int argument)
 {
     // Send cmd
@@ -34,18 +82,26 @@ static int sd_send_cmd_blocking(int cmd, int argument)
     }
 }
 
-int sd_read_sector_blocking(int id, void* buffer)
+// Stop a multiple block transfer
+static int sd_stop_transmission()
+{
+    return sd_send_cmd_blocking(SD_CMD_STOP_TRANSMISSION, 0);
+}
+
+int sd_read_sectors_blocking(int id, int count, void* buffer)
 {
     // Disable interrupts
-    disable_interrupts();
+    int old_ie = disable_interrupts();
     int result = 0;
 
     // Set dma_address
-    SD_CTRL[24] = 0;
+    int dma = sd_set_dma(buffer);
+    // Set block count, register keeps count - 1
+    SD_CTRL[18] = count - 1;
     // Clear data_event_status
     SD_CTRL[15] = 0;
-    // Tell sd ready to read
-    result = sd_send_cmd_blocking(0x1139, id);
+    // Tell sd ready to read, one command for the whole run
+    result = sd_send_cmd_blocking(count == 1 ? SD_CMD_READ_SINGLE_BLOCK : SD_CMD_READ_MULTIPLE_BLOCK, id);
     if (result != 0) {
         goto ret;
     }
@@ -57,9 +113,9 @@ int sd_read_sector_blocking(int id, void* buffer)
     } while (des == 0);
 
     if (des & 1) {
-        // Start reading
+        // Start reading, unless dma has already filled buffer
         int* buffer_int = (int*)buffer;
-        for (int i = 0; i < 128; i++) {
+        for (int i = 0; !dma && i < 128 * count; i++) {
             buffer_int[i] = SD_BUF[i];
         }
         result = 0;
@@ -67,20 +123,28 @@ int sd_read_sector_blocking(int id, void* buffer)
         // Error encountered
         result = des;
     }
+
+    if (count > 1 && sd_stop_transmission() != 0 && result == 0) {
+        result = 1;
+    }
 ret:
-    // Enable interrupts
-    enable_interrupts();
+    // Restore interrupts
+    if (old_ie) {
+        enable_interrupts();
+    }
     return result;
 }
 
-int sd_write_sector_blocking(int id, void* buffer)
+int sd_write_sectors_blocking(int id, int count, void* buffer)
 {
     // Disable interrupts
-    disable_interrupts();
+    int old_ie = disable_interrupts();
     int result = 0;
 
     // Set dma_address
-    SD_CTRL[24] = 0;
+    int dma = sd_set_dma(buffer);
+    // Set block count, register keeps count - 1
+    SD_CTRL[18] = count - 1;
     // Clear data_event_status
     SD_CTRL[15] = 0;
     // Wait bus until clear
@@ -88,13 +152,13 @@ int sd_write_sector_blocking(int id, void* buffer)
         "nop\n\t"
         "nop\n\t");
 
-    // Start writing
+    // Start writing, dma fetches buffer by itself
     int* buffer_int = (int*)buffer;
-    for (int i = 0; i < 128; i++) {
+    for (int i = 0; !dma && i < 128 * count; i++) {
         SD_BUF[i] = buffer_int[i];
     }
-    // Tell sd ready to write
-    result = sd_send_cmd_blocking(0x1859, id);
+    // Tell sd ready to write, one command for the whole run
+    result = sd_send_cmd_blocking(count == 1 ? SD_CMD_WRITE_BLOCK : SD_CMD_WRITE_MULTIPLE_BLOCK, id);
     if (result != 0) {
         goto ret;
     }
@@ -110,18 +174,370 @@ int sd_write_sector_blocking(int id, void* buffer)
     } else {
         result = des;
     }
+
+    if (count > 1 && sd_stop_transmission() != 0 && result == 0) {
+        result = 1;
+    }
 ret:
-    // Enable interrupts
-    enable_interrupts();
+    // Restore interrupts
+    if (old_ie) {
+        enable_interrupts();
+    }
     return result;
 }
 
+int sd_read_sector_blocking(int id, void* buffer)
+{
+    return sd_read_sectors_blocking(id, 1, buffer);
+}
+
+int sd_write_sector_blocking(int id, void* buffer)
+{
+    return sd_write_sectors_blocking(id, 1, buffer);
+}
+
+// Put request into queue in sector order
+static void sd_queue_add(struct sd_request* req)
+{
+    struct list_head* pos;
+
+    list_for_each(pos, &sd_queue)
+    {
+        if (list_entry(pos, struct sd_request, list)->id > req->id) {
+            break;
+        }
+    }
+    // Insert before first request with a larger sector
+    list_add_tail(&req->list, pos);
+
+    req->seq = sd_seq++;
+    sd_stats.requests++;
+    if (++sd_stats.depth > sd_stats.max_depth) {
+        sd_stats.max_depth = sd_stats.depth;
+    }
+}
+
+static void sd_queue_del(struct sd_request* req)
+{
+    list_del(&req->list);
+    sd_stats.depth--;
+}
+
+// Return an older pending request that must reach the card before req:
+// it touches the same sectors and one of both writes
+static struct sd_request* sd_blocked_by(struct sd_request* req)
+{
+    struct list_head* pos;
+    struct sd_request* q;
+
+    list_for_each(pos, &sd_queue)
+    {
+        q = list_entry(pos, struct sd_request, list);
+        if ((int)(q->seq - req->seq) < 0 && (q->write || req->write) && q->id < req->id + req->count && req->id < q->id + q->count) {
+            return q;
+        }
+    }
+    return 0;
+}
+
+// Elevator: next request at or after head in sector order, wrapping
+// around, unless the oldest one has waited too long
+static struct sd_request* sd_pick()
+{
+    struct list_head* pos;
+    struct sd_request *q, *pick = 0, *oldest = 0, *blocker;
+
+    list_for_each(pos, &sd_queue)
+    {
+        q = list_entry(pos, struct sd_request, list);
+        if (oldest == 0 || (int)(q->seq - oldest->seq) < 0) {
+            oldest = q;
+        }
+        if (pick == 0 && q->id >= sd_head) {
+            pick = q;
+        }
+    }
+    if (pick == 0) {
+        pick = list_entry(sd_queue.next, struct sd_request, list);
+    }
+    if (sd_seq - oldest->seq > SD_FIFO_EXPIRE) {
+        pick = oldest;
+    }
+    // Sorting must not reorder a read and a write of the same sector
+    while ((blocker = sd_blocked_by(pick)) != 0) {
+        pick = blocker;
+    }
+    return pick;
+}
+
+// Take picked request off the queue with every pending request that one
+// command can serve too: adjacent ones, and reads inside the same range
+static struct sd_request* sd_build_batch()
+{
+    struct list_head *pos, *n;
+    struct sd_request *first, *last, *q;
+    int end, q_end;
+
+    first = sd_pick();
+    sd_queue_del(first);
+    first->merge_next = 0;
+    last = first;
+    sd_active_start = first->id;
+    end = first->id + first->count;
+
+    list_for_each_safe(pos, n, &sd_queue)
+    {
+        q = list_entry(pos, struct sd_request, list);
+        q_end = q->id + q->count;
+        if (q->write != first->write || q->id < sd_active_start || q->id > end) {
+            continue;
+        }
+        if (q_end - sd_active_start > SD_BUF_SECTORS || sd_blocked_by(q) != 0) {
+            continue;
+        }
+        if (q->write && q->id != end) {
+            continue;
+        }
+
+        if (q_end <= end) {
+            // Same sectors are being read anyway
+            sd_stats.coalesced++;
+        } else {
+            sd_stats.merges++;
+            end = q_end;
+        }
+        sd_queue_del(q);
+        q->merge_next = 0;
+        last->merge_next = q;
+        last = q;
+    }
+
+    sd_active_count = end - sd_active_start;
+    return first;
+}
+
+// Program the controller and send command for a batch, data phase ends
+// with an interrupt
+static int sd_start_batch(struct sd_request* batch)
+{
+    struct sd_request* req;
+
+    // Set dma_address, only a single request has one contiguous buffer
+    batch->dma = batch->merge_next == 0 ? sd_set_dma(batch->buffer) : sd_set_dma(0);
+    // Set block count, register keeps count - 1
+    SD_CTRL[18] = sd_active_count - 1;
+    // Clear data_event_status
+    SD_CTRL[15] = 0;
+
+    sd_stats.dispatches++;
+    sd_head = sd_active_start + sd_active_count;
+
+    if (batch->write) {
+        // Wait bus until clear
+        asm volatile(
+            "nop\n\t"
+            "nop\n\t");
+        for (req = batch; !batch->dma && req; req = req->merge_next) {
+            int* buffer_int = (int*)req->buffer;
+            volatile unsigned int* sd_buf = SD_BUF + 128 * (req->id - sd_active_start);
+            for (int i = 0; i < 128 * req->count; i++) {
+                sd_buf[i] = buffer_int[i];
+            }
+        }
+        return sd_send_cmd_blocking(sd_active_count == 1 ? SD_CMD_WRITE_BLOCK : SD_CMD_WRITE_MULTIPLE_BLOCK, sd_active_start);
+    }
+
+    return sd_send_cmd_blocking(sd_active_count == 1 ? SD_CMD_READ_SINGLE_BLOCK : SD_CMD_READ_MULTIPLE_BLOCK, sd_active_start);
+}
+
+// Wake every request in a batch with result
+static void sd_finish_batch(struct sd_request* batch, int result)
+{
+    struct sd_request* req;
+    struct sd_request* next;
+
+    for (req = batch; req; req = next) {
+        // Request lives on its caller's stack, read link before waking it
+        next = req->merge_next;
+        req->result = result;
+        sem_signal(&req->done);
+    }
+}
+
+// Start next batch if card is idle
+static void sd_dispatch()
+{
+    struct sd_request* batch;
+
+    while (sd_active == 0 && !list_empty(&sd_queue)) {
+        batch = sd_build_batch();
+        if (sd_start_batch(batch) == 0) {
+            sd_active = batch;
+            break;
+        }
+        // Command failed, no data phase will follow
+        sd_finish_batch(batch, 1);
+    }
+}
+
+// Finish active batch with data event status, then start next one
+static void sd_complete(int des)
+{
+    struct sd_request* batch = sd_active;
+    struct sd_request* req;
+    int result;
+
+    if (des & 1) {
+        for (req = batch; !batch->write && !batch->dma && req; req = req->merge_next) {
+            int* buffer_int = (int*)req->buffer;
+            volatile unsigned int* sd_buf = SD_BUF + 128 * (req->id - sd_active_start);
+            for (int i = 0; i < 128 * req->count; i++) {
+                buffer_int[i] = sd_buf[i];
+            }
+        }
+        result = 0;
+    } else {
+        result = des;
+    }
+    if (sd_active_count > 1 && sd_stop_transmission() != 0 && result == 0) {
+        result = 1;
+    }
+
+    sd_active = 0;
+    sd_finish_batch(batch, result);
+    sd_dispatch();
+}
+
+// Interrupt handler, runs when data transfer of active batch ends
+void sd_interrupt(unsigned int status, unsigned int cause, context* pt_context)
+{
+    int des = SD_CTRL[15];
+    if (des == 0 || sd_active == 0) {
+        return;
+    }
+    SD_CTRL[15] = 0;
+    sd_complete(des);
+}
+
+// Busy wait for the active batch to end and complete it, interrupts off
+static void sd_poll_active()
+{
+    int des;
+
+    do {
+        des = SD_CTRL[15];
+    } while (des == 0);
+    SD_CTRL[15] = 0;
+    sd_complete(des);
+}
+
+// Put an initialized request on the queue, interrupts off
+static void sd_enqueue(struct sd_request* req, int id, int count, void* buffer, int write)
+{
+    req->id = id;
+    req->count = count;
+    req->buffer = buffer;
+    req->write = write;
+    req->dma = 0;
+    req->result = 0;
+    req->merge_next = 0;
+    req->done.count = 0;
+    INIT_LIST_HEAD(&req->done.wait_list);
+    sd_queue_add(req);
+    sd_dispatch();
+}
+
+// Issue one transfer, sleep until the interrupt if the scheduler can run
+// something else meanwhile, otherwise poll as before
+static int sd_submit(int id, int count, void* buffer, int write)
+{
+    struct sd_request req;
+    int old_ie = disable_interrupts();
+
+    // Caller keeps interrupts off (boot, or a section that must not be
+    // preempted), so nobody could wake us. Drain queue and poll.
+    if (!sd_async || !old_ie) {
+        while (sd_active) {
+            sd_poll_active();
+        }
+        if (old_ie) {
+            enable_interrupts();
+        }
+        return write ? sd_write_sectors_blocking(id, count, buffer) : sd_read_sectors_blocking(id, count, buffer);
+    }
+
+    sd_enqueue(&req, id, count, buffer, write);
+    enable_interrupts();
+
+    // Completion may already have signaled, then this does not block
+    sem_wait(&req.done);
+    return req.result;
+}
+
+// Start a read without waiting for it, the caller owns req until sd_wait
+// returns. A read that cannot be queued (no interrupts, or more sectors
+// than one command moves) is done right away and sd_wait just returns its
+// result. Return 1 only if that immediate read failed.
+u32 sd_read_async(struct sd_request* req, unsigned char* buf, unsigned long addr, unsigned long count)
+{
+    int old_ie = disable_interrupts();
+
+    if (!sd_async || !old_ie || count > SD_BUF_SECTORS) {
+        if (old_ie) {
+            enable_interrupts();
+        }
+        req->result = sd_read_block(buf, addr, count);
+        req->done.count = 1;
+        INIT_LIST_HEAD(&req->done.wait_list);
+        return req->result;
+    }
+
+    sd_enqueue(req, addr, count, buf, 0);
+    enable_interrupts();
+    return 0;
+}
+
+// Wait for a read started by sd_read_async, return its result
+u32 sd_wait(struct sd_request* req)
+{
+    int old_ie = disable_interrupts();
+
+    // Nobody could wake us, finish batches by polling until req is done
+    if (!old_ie) {
+        while (req->done.count == 0 && sd_active) {
+            sd_poll_active();
+        }
+        req->done.count--;
+        return req->result;
+    }
+
+    enable_interrupts();
+    sem_wait(&req->done);
+    return req->result;
+}
+
+// Switch to interrupt driven transfers, needs process control ready
+void init_sd_async()
+{
+    INIT_LIST_HEAD(&sd_queue);
+    sd_active = 0;
+    // Enable data event interrupts
+    SD_CTRL[16] = SD_DATA_INT_MASK;
+    register_interrupt_handler(SD_IRQ, sd_interrupt);
+    sd_async = 1;
+}
+
 u32 sd_read_block(unsigned char* buf, unsigned long addr, unsigned long count)
 {
-    // Read single/multiple block
+    // Read single/multiple block, at most SD_BUF_SECTORS per command
     u32 result;
-    for (int i = 0; i < count; ++i) {
-        result = sd_read_sector_blocking(addr + i, buf + i * SECSIZE);
+    unsigned long n;
+    for (unsigned long i = 0; i < count; i += n) {
+        n = count - i;
+        if (n > SD_BUF_SECTORS) {
+            n = SD_BUF_SECTORS;
+        }
+        result = sd_submit(addr + i, n, buf + i * SECSIZE, 0);
         if (0 != result) {
             goto error;
         }
@@ -134,10 +550,15 @@ error:
 
 u32 sd_write_block(unsigned char* buf, unsigned long addr, unsigned long count)
 {
-    // Write single/multiple block
+    // Write single/multiple block, at most SD_BUF_SECTORS per command
     u32 result;
-    for (int i = 0; i < count; ++i) {
-        result = sd_write_sector_blocking(addr + i, buf + i * SECSIZE);
+    unsigned long n;
+    for (unsigned long i = 0; i < count; i += n) {
+        n = count - i;
+        if (n > SD_BUF_SECTORS) {
+            n = SD_BUF_SECTORS;
+        }
+        result = sd_submit(addr + i, n, buf + i * SECSIZE, 1);
         if (0 != result) {
             goto error;
         }
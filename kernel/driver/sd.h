@@ -5,5 +5,7 @@
 
 int sd_write_sector_blocking(int id, void* buffer);
 int sd_read_sector_blocking(int id, void* buffer);
+int sd_write_sectors_blocking(int id, int count, void* buffer);
+int sd_read_sectors_blocking(int id, int count, void* buffer);
 
 #endif
@@ -0,0 +1,152 @@
+#include "bitmap.h"
+#include "fat.h"
+#include "utils.h"
+#include <xsu/log.h>
+#include <xsu/slab.h>
+#include <xsu/utils.h>
+
+/*
+ * Free cluster bitmap, one bit per cluster and set if the cluster is used.
+ * A 16GB card has millions of clusters, so the bitmap is kept in single
+ * pages indexed by fs_bitmap_pages instead of one large block.
+ */
+static uint32_t** fs_bitmap_pages = 0;
+static uint32_t fs_bitmap_page_num = 0;
+
+uint32_t fs_bitmap_ready()
+{
+    return fs_bitmap_pages != 0;
+}
+
+static void free_bitmap_release()
+{
+    uint32_t i;
+
+    for (i = 0; i < fs_bitmap_page_num; i++)
+        if (fs_bitmap_pages[i])
+            kfree(fs_bitmap_pages[i]);
+
+    if (fs_bitmap_pages)
+        kfree(fs_bitmap_pages);
+
+    fs_bitmap_pages = 0;
+    fs_bitmap_page_num = 0;
+}
+
+static uint32_t fs_bitmap_test(uint32_t clus)
+{
+    return (fs_bitmap_pages[clus / FS_BITMAP_PAGE_BITS][(clus % FS_BITMAP_PAGE_BITS) >> 5] >> (clus & 31)) & 1;
+}
+
+// Build bitmap by reading the whole FAT once.
+uint32_t init_free_bitmap()
+{
+    uint32_t clusters = fat_info.total_data_clusters + 2;
+    uint32_t fat_start = fat_info.BPB.attr.reserved_sectors + fat_info.active_fat * fat_info.sectors_per_fat + fat_info.base_addr;
+    uint32_t fat_sectors = (clusters + 127) >> 7;
+    uint32_t free_count = 0;
+    uint8_t* sec_buf;
+    uint32_t sec, count, i, clus;
+
+    free_bitmap_release();
+
+    fs_bitmap_page_num = (clusters + FS_BITMAP_PAGE_BITS - 1) / FS_BITMAP_PAGE_BITS;
+    fs_bitmap_pages = (uint32_t**)kmalloc(fs_bitmap_page_num * sizeof(uint32_t*));
+    if (fs_bitmap_pages == 0)
+        goto init_free_bitmap_err;
+    kernel_memset(fs_bitmap_pages, 0, fs_bitmap_page_num * sizeof(uint32_t*));
+
+    for (i = 0; i < fs_bitmap_page_num; i++) {
+        fs_bitmap_pages[i] = (uint32_t*)kmalloc(4096);
+        if (fs_bitmap_pages[i] == 0)
+            goto init_free_bitmap_err;
+        kernel_clear_page(fs_bitmap_pages[i]);
+    }
+
+    // Read FAT 8 sectors at a time.
+    sec_buf = (uint8_t*)kmalloc(4096);
+    if (sec_buf == 0)
+        goto init_free_bitmap_err;
+
+    clus = 0;
+    for (sec = 0; sec < fat_sectors; sec += count) {
+        count = fat_sectors - sec < 8 ? fat_sectors - sec : 8;
+        if (read_block(sec_buf, fat_start + sec, count) == 1) {
+            kfree(sec_buf);
+            goto init_free_bitmap_err;
+        }
+
+        for (i = 0; i < (count << 7) && clus < clusters; i++, clus++) {
+            if ((get_uint32_t(sec_buf + (i << 2)) & 0x0FFFFFFF) != 0 || clus < 2)
+                fs_bitmap_pages[clus / FS_BITMAP_PAGE_BITS][(clus % FS_BITMAP_PAGE_BITS) >> 5] |= 1 << (clus & 31);
+            else
+                free_count++;
+        }
+    }
+    kfree(sec_buf);
+
+    // FSI_Free_Count is only a hint, correct it now that we know.
+    set_uint32_t(fat_info.fat_fs_info + 488, free_count);
+    log(LOG_OK, "Free cluster bitmap built, %d clusters free", free_count);
+
+    return 0;
+
+init_free_bitmap_err:
+    free_bitmap_release();
+    log(LOG_FAIL, "Free cluster bitmap unavailable, fallback to FAT scanning");
+    return 1;
+}
+
+// Keep bitmap and FSI_Free_Count in sync with a FAT entry change.
+void fs_bitmap_set(uint32_t clus, uint32_t used)
+{
+    uint32_t* word;
+    uint32_t bit = 1 << (clus & 31);
+    uint32_t free_count;
+
+    if (fs_bitmap_pages == 0 || clus > fat_info.total_data_clusters + 1)
+        return;
+
+    word = fs_bitmap_pages[clus / FS_BITMAP_PAGE_BITS] + ((clus % FS_BITMAP_PAGE_BITS) >> 5);
+    if (((*word & bit) != 0) == (used != 0))
+        return;
+
+    free_count = get_uint32_t(fat_info.fat_fs_info + 488);
+    if (used) {
+        *word |= bit;
+        free_count--;
+    } else {
+        *word &= ~bit;
+        free_count++;
+    }
+    set_uint32_t(fat_info.fat_fs_info + 488, free_count);
+}
+
+uint32_t fs_bitmap_is_free(uint32_t clus)
+{
+    return !fs_bitmap_test(clus);
+}
+
+// Find first free cluster from start, 0xffffffff if none.
+uint32_t fs_bitmap_next_free(uint32_t start)
+{
+    uint32_t clus = start;
+    uint32_t last = fat_info.total_data_clusters + 1;
+    uint32_t word;
+
+    while (clus <= last) {
+        word = fs_bitmap_pages[clus / FS_BITMAP_PAGE_BITS][(clus % FS_BITMAP_PAGE_BITS) >> 5];
+
+        // Skip 32 used clusters at once.
+        if ((clus & 31) == 0 && word == 0xffffffff) {
+            clus += 32;
+            continue;
+        }
+
+        if (!fs_bitmap_test(clus))
+            return clus;
+        clus++;
+    }
+
+    return 0xffffffff;
+}
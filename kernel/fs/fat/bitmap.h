@@ -0,0 +1,15 @@
+#ifndef _FAT_BITMAP_H
+#define _FAT_BITMAP_H
+
+#include <xsu/types.h>
+
+/* clusters tracked by one bitmap page */
+#define FS_BITMAP_PAGE_BITS (4096 << 3)
+
+uint32_t init_free_bitmap();
+void fs_bitmap_set(uint32_t clus, uint32_t used);
+uint32_t fs_bitmap_next_free(uint32_t start);
+uint32_t fs_bitmap_is_free(uint32_t clus);
+uint32_t fs_bitmap_ready();
+
+#endif
@@ -1,7 +1,11 @@
 #include "dir.h"
 #include "fat.h"
+#include "lfn.h"
 #include "utils.h"
+#include <xsu/fs/dirent.h>
 #include <xsu/fs/fscache.h>
+#include <xsu/uio.h>
+#include <xsu/utils.h>
 
 // Used to find or create a directory entry.
 #define DIR_DATA_BUF_NUM 4
@@ -54,6 +58,7 @@ uint32_t fs_open_dir(FS_FAT_DIR* dir, uint8_t* filename)
             goto fs_open_dir_err;
     }
 
+    dir->start_sector = dir->cur_sector;
     return 0;
 
 fs_open_dir_err:
@@ -125,3 +130,116 @@ after_fs_read_dir_nomore:
 fs_read_dir_err:
     return 1;
 }
+
+// Read dir entries as struct dirent records, as many as fit in uio.
+// uio offset is a position cookie, sector << 4 | entry in sector, 0 for
+// the first entry and -1 past the end of a full directory. Directory sector is looked up once per sector instead
+// of once per entry.
+uint32_t fs_read_dirents(FS_FAT_DIR* dir, struct uio* uio)
+{
+    struct dirent d;
+    struct lfn_state lfn;
+    uint8_t* entry;
+    uint32_t reclen;
+    uint32_t index;
+    uint32_t next_clus;
+    uint32_t len;
+
+    if (uio->uio_offset == -1)
+        return 0;
+
+    // Cookie never points into long name entries, so no name is cut.
+    lfn_reset(&lfn);
+
+    if (uio->uio_offset == 0) {
+        dir->cur_sector = dir->start_sector;
+        dir->loc = 0;
+    } else {
+        dir->cur_sector = (uint32_t)(uio->uio_offset >> 4);
+        dir->loc = ((uint32_t)uio->uio_offset & 15) << 5;
+    }
+    dir->sec = ((dir->cur_sector - fat_info.first_data_sector) & (fat_info.BPB.attr.sectors_per_cluster - 1)) + 1;
+
+    index = fs_read_512(dir_data_buf, dir->cur_sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+    if (index == 0xffffffff)
+        goto fs_read_dirents_err;
+
+    while (1) {
+        for (; dir->loc < 512; dir->loc += 32) {
+            entry = dir_data_buf[index].buf + dir->loc;
+            if (entry[0] == 0)
+                goto fs_read_dirents_end;
+
+            // Ignore deleted file and volume label, collect long name.
+            if (entry[0] == 0xE5) {
+                lfn_reset(&lfn);
+                continue;
+            }
+            if ((entry[11] & LFN_ATTR) == LFN_ATTR) {
+                lfn_collect(&lfn, entry, dir->cur_sector, dir->loc);
+                continue;
+            }
+            if ((entry[11] & 0x08) != 0) {
+                lfn_reset(&lfn);
+                continue;
+            }
+
+            len = lfn_finish(&lfn, entry);
+            if (len != 0) {
+                kernel_memcpy(d.d_name, lfn.name, len + 1);
+                d.d_namlen = len;
+            } else {
+                get_filename(entry, (uint8_t*)d.d_name);
+                d.d_namlen = kernel_strlen(d.d_name);
+            }
+            reclen = DIRENT_RECLEN(d.d_namlen);
+
+            // Buffer is full, entry and its long name are returned by next call.
+            if (reclen > uio->uio_resid) {
+                if (len != 0) {
+                    dir->cur_sector = lfn.loc.sector;
+                    dir->loc = lfn.loc.offset;
+                }
+                goto fs_read_dirents_end;
+            }
+
+            d.d_reclen = reclen;
+            d.d_attr = entry[11];
+            d.d_size = get_entry_filesize(entry);
+            d.d_date = ((union dir_entry*)entry)->attr.date;
+            d.d_time = ((union dir_entry*)entry)->attr.time;
+            uiomove(&d, reclen, uio);
+        }
+
+        // Next sector in current cluster.
+        if (dir->sec < fat_info.BPB.attr.sectors_per_cluster) {
+            dir->sec++;
+            dir->cur_sector++;
+        } else {
+            // Read next cluster of current directory.
+            if (get_fat_entry_value(fs_sec2dataclus(dir->cur_sector), &next_clus) == 1)
+                goto fs_read_dirents_err;
+
+            // Chain ends without an end mark, no position after last entry.
+            if (next_clus > fat_info.total_data_clusters + 1) {
+                uio->uio_offset = -1;
+                return 0;
+            }
+
+            dir->sec = 1;
+            dir->cur_sector = fs_dataclus2sec(next_clus);
+        }
+        dir->loc = 0;
+
+        index = fs_read_512(dir_data_buf, dir->cur_sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+        if (index == 0xffffffff)
+            goto fs_read_dirents_err;
+    }
+
+fs_read_dirents_end:
+    // At end of directory cookie stays at the end mark, next call reads nothing.
+    uio->uio_offset = ((off_t)dir->cur_sector << 4) | (dir->loc >> 5);
+    return 0;
+fs_read_dirents_err:
+    return 1;
+}
@@ -0,0 +1,530 @@
+#include "dirindex.h"
+#include "fat.h"
+#include "lfn.h"
+#include "utils.h"
+#include <xsu/slab.h>
+
+// Directory sectors are read through the same buffer as fs_find.
+#define DIR_DATA_BUF_NUM 4
+extern BUF_512 dir_data_buf[DIR_DATA_BUF_NUM];
+extern uint32_t dir_data_clock_head;
+
+/* one directory entry in the index */
+struct dir_index_entry {
+    uint8_t name[11];
+    /* entry number in sector */
+    uint8_t slot;
+    /* sector holding the entry, partition relative */
+    uint32_t sector;
+    /* next entry in the same bucket */
+    uint32_t next;
+    /* long name record in names, 0xffffffff if none */
+    uint32_t lfn;
+    /* next entry in the same long name bucket */
+    uint32_t lfn_next;
+};
+
+/* long name of an entry, kept in names of its directory index */
+struct dir_index_lfn {
+    /* first long name entry */
+    uint32_t sector;
+    uint8_t slot;
+    uint8_t num;
+    uint8_t len;
+    uint8_t name[1];
+};
+
+/* size of a long name record, records stay word aligned */
+#define DIR_INDEX_LFN_SIZE(len) ((sizeof(struct dir_index_lfn) + (len) + 3) & ~3)
+
+/* name index of one directory, built by scanning it once */
+struct dir_index {
+    /* first cluster of directory, 0 if slot is unused */
+    uint32_t clus;
+    /* last use, for replacement */
+    uint32_t stamp;
+    uint32_t num;
+    uint32_t cap;
+    struct dir_index_entry* entries;
+    uint32_t hash_head[FS_DIR_HASH_NUM];
+    /* long names, looked up through their own buckets */
+    uint8_t* names;
+    uint32_t names_len;
+    uint32_t names_cap;
+    uint32_t lfn_head[FS_DIR_HASH_NUM];
+    /* deleted slots in directory, linked through entries */
+    uint32_t free_head;
+    /* unused elements of entries, linked through next */
+    uint32_t spare_head;
+    /* first never used slot (0x00 entry), 0xffffffff if unknown */
+    uint32_t end_sector;
+    uint32_t end_offset;
+};
+
+static struct dir_index dir_index[FS_DIR_INDEX_NUM];
+static uint32_t dir_index_stamp = 0;
+
+static uint32_t dir_index_hash(const uint8_t* name)
+{
+    uint32_t h = 0;
+    uint32_t i;
+
+    for (i = 0; i < 11; i++)
+        h = (h << 3) + (h >> 29) + name[i];
+
+    return (h ^ (h >> 16)) & (FS_DIR_HASH_NUM - 1);
+}
+
+// Long names are hashed without case, as they are compared.
+static uint32_t dir_index_lfn_hash(const uint8_t* name, uint32_t len)
+{
+    uint32_t h = 0;
+    uint32_t i;
+    uint8_t c;
+
+    for (i = 0; i < len; i++) {
+        c = name[i];
+        if (c >= 'a' && c <= 'z')
+            c = c - 'a' + 'A';
+        h = (h << 3) + (h >> 29) + c;
+    }
+
+    return (h ^ (h >> 16)) & (FS_DIR_HASH_NUM - 1);
+}
+
+static struct dir_index_lfn* dir_index_lfn_get(struct dir_index* idx, uint32_t lfn)
+{
+    return (struct dir_index_lfn*)(idx->names + lfn);
+}
+
+static void dir_index_release(struct dir_index* idx)
+{
+    if (idx->entries)
+        kfree(idx->entries);
+    if (idx->names)
+        kfree(idx->names);
+
+    idx->entries = 0;
+    idx->names = 0;
+    idx->clus = 0;
+    idx->num = 0;
+    idx->cap = 0;
+    idx->names_len = 0;
+    idx->names_cap = 0;
+}
+
+// Drop all indexes, used when a card is mounted.
+void init_dir_index()
+{
+    uint32_t i;
+
+    for (i = 0; i < FS_DIR_INDEX_NUM; i++)
+        dir_index_release(dir_index + i);
+}
+
+// Get an unused element of entries, doubling the array when full.
+static uint32_t dir_index_alloc(struct dir_index* idx)
+{
+    struct dir_index_entry* entries;
+    uint32_t i;
+
+    if (idx->spare_head != 0xffffffff) {
+        i = idx->spare_head;
+        idx->spare_head = idx->entries[i].next;
+        return i;
+    }
+
+    if (idx->num == idx->cap) {
+        if (idx->cap == FS_DIR_INDEX_MAX)
+            goto dir_index_alloc_err;
+
+        entries = (struct dir_index_entry*)kmalloc((idx->cap ? idx->cap << 1 : 32) * sizeof(struct dir_index_entry));
+        if (entries == 0)
+            goto dir_index_alloc_err;
+
+        for (i = 0; i < idx->num; i++)
+            entries[i] = idx->entries[i];
+
+        if (idx->entries)
+            kfree(idx->entries);
+        idx->entries = entries;
+        idx->cap = idx->cap ? idx->cap << 1 : 32;
+    }
+
+    return idx->num++;
+dir_index_alloc_err:
+    return 0xffffffff;
+}
+
+// Store a long name, doubling the name pool when full.
+static uint32_t dir_index_lfn_store(struct dir_index* idx, const uint8_t* name, uint32_t len, const struct lfn_loc* loc)
+{
+    struct dir_index_lfn* rec;
+    uint8_t* names;
+    uint32_t size = DIR_INDEX_LFN_SIZE(len);
+    uint32_t cap;
+    uint32_t i;
+
+    if (idx->names_len + size > idx->names_cap) {
+        for (cap = idx->names_cap ? idx->names_cap : 1024; cap < idx->names_len + size; cap <<= 1)
+            ;
+        if (cap > FS_DIR_NAMES_MAX)
+            return 0xffffffff;
+
+        names = (uint8_t*)kmalloc(cap);
+        if (names == 0)
+            return 0xffffffff;
+
+        for (i = 0; i < idx->names_len; i++)
+            names[i] = idx->names[i];
+
+        if (idx->names)
+            kfree(idx->names);
+        idx->names = names;
+        idx->names_cap = cap;
+    }
+
+    rec = dir_index_lfn_get(idx, idx->names_len);
+    rec->sector = loc->sector;
+    rec->slot = loc->offset >> 5;
+    rec->num = loc->num;
+    rec->len = len;
+    for (i = 0; i < len; i++)
+        rec->name[i] = name[i];
+    rec->name[len] = 0;
+
+    idx->names_len += size;
+    return idx->names_len - size;
+}
+
+// Add a named entry, lname is its long name or 0.
+static uint32_t dir_index_insert(struct dir_index* idx, const uint8_t* name, const uint8_t* lname, uint32_t llen, uint32_t sector,
+    uint32_t offset, const struct lfn_loc* lfn)
+{
+    struct dir_index_entry* e;
+    uint32_t bucket;
+    uint32_t i;
+
+    i = dir_index_alloc(idx);
+    if (i == 0xffffffff)
+        return 1;
+
+    e = idx->entries + i;
+    for (bucket = 0; bucket < 11; bucket++)
+        e->name[bucket] = name[bucket];
+    e->sector = sector;
+    e->slot = offset >> 5;
+
+    bucket = dir_index_hash(name);
+    e->next = idx->hash_head[bucket];
+    idx->hash_head[bucket] = i;
+
+    e->lfn = 0xffffffff;
+    if (lname != 0 && llen != 0) {
+        e->lfn = dir_index_lfn_store(idx, lname, llen, lfn);
+        if (e->lfn == 0xffffffff)
+            return 1;
+
+        bucket = dir_index_lfn_hash(lname, llen);
+        e->lfn_next = idx->lfn_head[bucket];
+        idx->lfn_head[bucket] = i;
+    }
+
+    return 0;
+}
+
+// Remember a deleted slot for reuse.
+static uint32_t dir_index_insert_free(struct dir_index* idx, uint32_t sector, uint32_t offset)
+{
+    uint32_t i;
+
+    i = dir_index_alloc(idx);
+    if (i == 0xffffffff)
+        return 1;
+
+    idx->entries[i].sector = sector;
+    idx->entries[i].slot = offset >> 5;
+    idx->entries[i].next = idx->free_head;
+    idx->free_head = i;
+
+    return 0;
+}
+
+// Scan a directory once and index every valid entry by short and long name.
+static uint32_t dir_index_build(struct dir_index* idx, uint32_t dir_clus)
+{
+    struct lfn_state lfn;
+    uint32_t clus = dir_clus;
+    uint32_t sec, i, index;
+    uint32_t len;
+    uint8_t* entry;
+
+    idx->num = 0;
+    idx->free_head = 0xffffffff;
+    idx->spare_head = 0xffffffff;
+    idx->end_sector = 0xffffffff;
+    idx->end_offset = 0;
+    idx->names_len = 0;
+    for (i = 0; i < FS_DIR_HASH_NUM; i++) {
+        idx->hash_head[i] = 0xffffffff;
+        idx->lfn_head[i] = 0xffffffff;
+    }
+    lfn_reset(&lfn);
+
+    while (clus >= 2 && clus <= fat_info.total_data_clusters + 1) {
+        for (sec = 0; sec < fat_info.BPB.attr.sectors_per_cluster; sec++) {
+            index = fs_read_512(dir_data_buf, fs_dataclus2sec(clus) + sec, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+            if (index == 0xffffffff)
+                goto dir_index_build_err;
+
+            for (i = 0; i < 512; i += 32) {
+                entry = dir_data_buf[index].buf + i;
+                // End of directory.
+                if (entry[0] == 0) {
+                    idx->end_sector = fs_dataclus2sec(clus) + sec;
+                    idx->end_offset = i;
+                    goto dir_index_build_ok;
+                }
+                if (entry[0] == 0xE5) {
+                    lfn_reset(&lfn);
+                    if (dir_index_insert_free(idx, fs_dataclus2sec(clus) + sec, i) == 1)
+                        goto dir_index_build_err;
+                    continue;
+                }
+                // Long name, belongs to the next short entry.
+                if ((entry[11] & LFN_ATTR) == LFN_ATTR) {
+                    lfn_collect(&lfn, entry, fs_dataclus2sec(clus) + sec, i);
+                    continue;
+                }
+                // Volume label.
+                if ((entry[11] & 0x08) != 0) {
+                    lfn_reset(&lfn);
+                    continue;
+                }
+                len = lfn_finish(&lfn, entry);
+                if (dir_index_insert(idx, entry, lfn.name, len, fs_dataclus2sec(clus) + sec, i, &lfn.loc) == 1)
+                    goto dir_index_build_err;
+            }
+        }
+
+        if (get_fat_entry_value(clus, &clus) == 1)
+            goto dir_index_build_err;
+    }
+
+dir_index_build_ok:
+    idx->clus = dir_clus;
+    return 0;
+dir_index_build_err:
+    dir_index_release(idx);
+    return 1;
+}
+
+// Index of a directory if it has one already.
+static struct dir_index* dir_index_get(uint32_t dir_clus)
+{
+    uint32_t i;
+
+    for (i = 0; i < FS_DIR_INDEX_NUM; i++)
+        if (dir_index[i].clus == dir_clus) {
+            dir_index[i].stamp = ++dir_index_stamp;
+            return dir_index + i;
+        }
+
+    return 0;
+}
+
+// Look up a name in a directory, building its index on first use. lname is
+// the long name to look for, or 0 to look for short name. Returns 0 and the
+// entry location if found, 1 if the directory has no such entry,
+// 0xffffffff if the directory could not be indexed.
+uint32_t fs_dir_index_find(uint32_t dir_clus, const uint8_t* name, const uint8_t* lname, uint32_t* sector, uint32_t* offset,
+    struct lfn_loc* lfn)
+{
+    struct dir_index* idx;
+    struct dir_index_entry* e;
+    struct dir_index_lfn* rec;
+    uint32_t llen;
+    uint32_t i;
+
+    idx = dir_index_get(dir_clus);
+    if (idx == 0) {
+        // Replace least recently used slot.
+        idx = dir_index;
+        for (i = 1; i < FS_DIR_INDEX_NUM; i++)
+            if (dir_index[i].clus == 0 || (idx->clus != 0 && dir_index[i].stamp < idx->stamp))
+                idx = dir_index + i;
+
+        dir_index_release(idx);
+        if (dir_index_build(idx, dir_clus) == 1)
+            return 0xffffffff;
+        idx->stamp = ++dir_index_stamp;
+    }
+
+    if (lname != 0) {
+        for (llen = 0; lname[llen] != 0; llen++)
+            ;
+        for (i = idx->lfn_head[dir_index_lfn_hash(lname, llen)]; i != 0xffffffff; i = e->lfn_next) {
+            e = idx->entries + i;
+            rec = dir_index_lfn_get(idx, e->lfn);
+            if (rec->len == llen && lfn_cmp(rec->name, lname, llen) == 0)
+                goto dir_index_find_ok;
+        }
+    } else {
+        for (i = idx->hash_head[dir_index_hash(name)]; i != 0xffffffff; i = e->next) {
+            e = idx->entries + i;
+            if (fs_cmp_filename(e->name, name) == 0)
+                goto dir_index_find_ok;
+        }
+    }
+
+    return 1;
+
+dir_index_find_ok:
+    *sector = e->sector;
+    *offset = e->slot << 5;
+    if (lfn != 0) {
+        lfn->num = 0;
+        if (e->lfn != 0xffffffff) {
+            rec = dir_index_lfn_get(idx, e->lfn);
+            lfn->sector = rec->sector;
+            lfn->offset = rec->slot << 5;
+            lfn->num = rec->num;
+        }
+    }
+    return 0;
+}
+
+// Record a new entry written into an indexed directory, lname is 0 if it
+// has no long name.
+void fs_dir_index_add(uint32_t dir_clus, const uint8_t* name, const uint8_t* lname, uint32_t sector, uint32_t offset,
+    const struct lfn_loc* lfn)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+    uint32_t llen = 0;
+
+    if (lname != 0)
+        for (; lname[llen] != 0; llen++)
+            ;
+
+    // Index that cannot grow would miss the entry, rebuild on next lookup.
+    if (idx && dir_index_insert(idx, name, lname, llen, sector, offset, lfn) == 1)
+        dir_index_release(idx);
+}
+
+// Remember a slot freed in an indexed directory, such as a long name entry.
+void fs_dir_index_add_free(uint32_t dir_clus, uint32_t sector, uint32_t offset)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+
+    if (idx && dir_index_insert_free(idx, sector, offset) == 1)
+        dir_index_release(idx);
+}
+
+// Forget an entry deleted from a directory, its slot can be reused.
+void fs_dir_index_remove(uint32_t dir_clus, uint32_t sector, uint32_t offset)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+    struct dir_index_lfn* rec;
+    uint32_t* link;
+    uint32_t i;
+
+    if (idx == 0)
+        return;
+
+    for (i = 0; i < FS_DIR_HASH_NUM; i++)
+        for (link = idx->hash_head + i; *link != 0xffffffff; link = &(idx->entries[*link].next))
+            if (idx->entries[*link].sector == sector && idx->entries[*link].slot == offset >> 5)
+                goto dir_index_remove_found;
+
+    return;
+
+dir_index_remove_found:
+    // Element moves from its bucket to the free slot list.
+    i = *link;
+    *link = idx->entries[i].next;
+    idx->entries[i].next = idx->free_head;
+    idx->free_head = i;
+
+    if (idx->entries[i].lfn == 0xffffffff)
+        return;
+
+    rec = dir_index_lfn_get(idx, idx->entries[i].lfn);
+    for (link = idx->lfn_head + dir_index_lfn_hash(rec->name, rec->len); *link != 0xffffffff; link = &(idx->entries[*link].lfn_next))
+        if (*link == i) {
+            *link = idx->entries[i].lfn_next;
+            break;
+        }
+    idx->entries[i].lfn = 0xffffffff;
+}
+
+// Advance end of directory past a slot that has just been used.
+static void dir_index_end_after(struct dir_index* idx, uint32_t sector, uint32_t offset)
+{
+    idx->end_sector = sector;
+    idx->end_offset = offset + 32;
+    if (idx->end_offset == 512) {
+        idx->end_sector++;
+        idx->end_offset = 0;
+        // Directory continues in a cluster that does not exist yet.
+        if (((idx->end_sector - fat_info.first_data_sector) & (fat_info.BPB.attr.sectors_per_cluster - 1)) == 0)
+            idx->end_sector = 0xffffffff;
+    }
+}
+
+// Take count free slots in a row of an indexed directory for a new entry
+// and its long name. A single slot may be a deleted one, otherwise slots
+// are taken from the end of directory if its last cluster has room.
+// Returns 1 if none are known, then the directory has to be scanned and
+// maybe extended.
+uint32_t fs_dir_index_take_free(uint32_t dir_clus, uint32_t count, uint32_t* sector, uint32_t* offset)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+    uint32_t used;
+    uint32_t i;
+
+    if (idx == 0)
+        return 1;
+
+    if (count == 1 && idx->free_head != 0xffffffff) {
+        i = idx->free_head;
+        idx->free_head = idx->entries[i].next;
+        *sector = idx->entries[i].sector;
+        *offset = idx->entries[i].slot << 5;
+        idx->entries[i].next = idx->spare_head;
+        idx->spare_head = i;
+        return 0;
+    }
+
+    if (idx->end_sector == 0xffffffff)
+        return 1;
+
+    // Slots of last cluster before end of directory.
+    used = (((idx->end_sector - fat_info.first_data_sector) & (fat_info.BPB.attr.sectors_per_cluster - 1)) << 4) + (idx->end_offset >> 5);
+    if (used + count > (fat_info.BPB.attr.sectors_per_cluster << 4))
+        return 1;
+
+    *sector = idx->end_sector;
+    *offset = idx->end_offset;
+    for (i = 0; i < count; i++)
+        dir_index_end_after(idx, idx->end_sector, idx->end_offset);
+    return 0;
+}
+
+// Slots from end of directory up to this one have been used by scanning
+// (usually into a newly added cluster), following slots are free.
+void fs_dir_index_set_end(uint32_t dir_clus, uint32_t sector, uint32_t offset)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+
+    if (idx)
+        dir_index_end_after(idx, sector, offset);
+}
+
+// Directory has been removed, its clusters may be reused.
+void fs_dir_index_drop(uint32_t dir_clus)
+{
+    struct dir_index* idx = dir_index_get(dir_clus);
+
+    if (idx)
+        dir_index_release(idx);
+}
@@ -0,0 +1,27 @@
+#ifndef _FAT_DIRINDEX_H
+#define _FAT_DIRINDEX_H
+
+#include <xsu/fs/fat.h>
+#include <xsu/types.h>
+
+/* directories indexed at the same time */
+#define FS_DIR_INDEX_NUM 8
+/* hash buckets per directory, must be power of 2 */
+#define FS_DIR_HASH_NUM 64
+/* larger directories are scanned linearly */
+#define FS_DIR_INDEX_MAX 2048
+/* bytes of long names per directory */
+#define FS_DIR_NAMES_MAX 65536
+
+void init_dir_index();
+uint32_t fs_dir_index_find(uint32_t dir_clus, const uint8_t* name, const uint8_t* lname, uint32_t* sector, uint32_t* offset,
+    struct lfn_loc* lfn);
+void fs_dir_index_add(uint32_t dir_clus, const uint8_t* name, const uint8_t* lname, uint32_t sector, uint32_t offset,
+    const struct lfn_loc* lfn);
+void fs_dir_index_add_free(uint32_t dir_clus, uint32_t sector, uint32_t offset);
+void fs_dir_index_remove(uint32_t dir_clus, uint32_t sector, uint32_t offset);
+uint32_t fs_dir_index_take_free(uint32_t dir_clus, uint32_t count, uint32_t* sector, uint32_t* offset);
+void fs_dir_index_set_end(uint32_t dir_clus, uint32_t sector, uint32_t offset);
+void fs_dir_index_drop(uint32_t dir_clus);
+
+#endif
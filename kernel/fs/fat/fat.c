@@ -1,7 +1,15 @@
 #include "fat.h"
+#include "bitmap.h"
+#include "dirindex.h"
+#include "lfn.h"
 #include "utils.h"
 #include <driver/vga.h>
+#include <intr.h>
+#include <xsu/fs/dcache.h>
 #include <xsu/log.h>
+#include <xsu/pc.h>
+#include <xsu/slab.h>
+#include <xsu/syscall.h>
 #include <xsu/time.h>
 
 #ifdef FS_DEBUG
@@ -15,6 +23,10 @@ uint32_t fat_clock_head = 0;
 BUF_512 fat_buf[FAT_BUF_NUM];
 
 uint8_t filename11[13];
+/* last path component as given, used when it needs a long name */
+uint8_t filename_long[LFN_NAME_MAX + 1];
+uint32_t filename_long_len;
+uint32_t filename_lfn;
 uint8_t new_alloc_empty[PAGE_SIZE];
 
 #define DIR_DATA_BUF_NUM 4
@@ -23,6 +35,12 @@ uint32_t dir_data_clock_head = 0;
 
 struct fs_info fat_info;
 
+/* FAT sectors written to active FAT but not to its copies yet, one bit each */
+static uint32_t* fat_mirror_dirty = 0;
+static uint8_t fat_mirror_buf[8 * SECTOR_SIZE];
+/* flusher syncs FAT copies on its own, while foreground may be doing it too */
+static uint8_t fat_flush_mirror_buf[8 * SECTOR_SIZE];
+
 uint32_t init_fat_info()
 {
     uint8_t meta_buf[512];
@@ -70,16 +88,25 @@ uint32_t init_fat_info()
     uint32_t total_sectors = fat_info.BPB.attr.num_of_sectors;
     uint32_t reserved_sectors = fat_info.BPB.attr.reserved_sectors;
     uint32_t sectors_per_fat = fat_info.BPB.attr.num_of_sectors_per_fat;
-    uint32_t total_data_sectors = total_sectors - reserved_sectors - sectors_per_fat * 2;
+    uint32_t num_of_fats = fat_info.BPB.attr.number_of_copies_of_fat;
+    uint32_t total_data_sectors = total_sectors - reserved_sectors - sectors_per_fat * num_of_fats;
     uint8_t sectors_per_cluster = fat_info.BPB.attr.sectors_per_cluster;
     fat_info.total_data_clusters = total_data_sectors / sectors_per_cluster;
     if (fat_info.total_data_clusters < 65525) {
         goto init_fat_info_err;
     }
     // Get root dir sector.
-    fat_info.first_data_sector = reserved_sectors + sectors_per_fat * 2;
+    fat_info.first_data_sector = reserved_sectors + sectors_per_fat * num_of_fats;
+    fat_info.sectors_per_fat = sectors_per_fat;
     log(LOG_OK, "Partition type determined: FAT32");
 
+    // Flags bit 7 set: mirroring disabled, only FAT in bits 0-3 is active.
+    fat_info.active_fat = 0;
+    if (fat_info.BPB.attr.flags & 0x80)
+        fat_info.active_fat = fat_info.BPB.attr.flags & 0x0F;
+    if (fat_info.active_fat >= num_of_fats)
+        goto init_fat_info_err;
+
     // Keep FSInfo in buffer.
     read_block(fat_info.fat_fs_info, 1 + fat_info.base_addr, 1);
     log(LOG_OK, "Get FSInfo sector");
@@ -95,6 +122,38 @@ init_fat_info_err:
     return 1;
 }
 
+// Number of FAT copies to keep equal to the active one.
+static uint32_t fat_mirror_num()
+{
+    // Mirroring disabled in BPB flags.
+    if (fat_info.BPB.attr.flags & 0x80)
+        return 0;
+
+    return fat_info.BPB.attr.number_of_copies_of_fat - 1;
+}
+
+// Init mirror bitmap, without it every FAT sector write goes to all copies.
+static void init_fat_mirror()
+{
+    uint32_t size = ((fat_info.sectors_per_fat + 31) >> 5) << 2;
+
+    if (fat_mirror_dirty)
+        kfree(fat_mirror_dirty);
+    fat_mirror_dirty = 0;
+
+#ifndef FS_FAT_MIRROR_SYNC
+    if (fat_mirror_num() == 0)
+        return;
+
+    fat_mirror_dirty = (uint32_t*)kmalloc(size);
+    if (fat_mirror_dirty == 0) {
+        log(LOG_FAIL, "FAT mirror bitmap alloc fail, mirror FAT synchronously.");
+        return;
+    }
+    kernel_memset(fat_mirror_dirty, 0, size);
+#endif
+}
+
 void init_fat_buf()
 {
     int i = 0;
@@ -121,6 +180,12 @@ uint32_t init_fs()
         goto fs_init_err;
     init_fat_buf();
     init_dir_buf();
+    init_fat_mirror();
+    init_dir_index();
+    if (init_fscache_4k() == 1)
+        goto fs_init_err;
+    // Without bitmap, allocation falls back to scanning FAT.
+    init_free_bitmap();
     return 0;
 
 fs_init_err:
@@ -128,15 +193,55 @@ fs_init_err:
     return 1;
 }
 
+// Write one sector of active FAT to all mirror copies.
+static uint32_t write_fat_mirror(uint8_t* buf, uint32_t sec, uint32_t count)
+{
+    uint32_t i;
+    uint32_t fat;
+
+    for (fat = 0, i = 0; i < fat_mirror_num(); fat++) {
+        if (fat == fat_info.active_fat)
+            continue;
+        if (write_block(buf, fat_info.BPB.attr.reserved_sectors + fat * fat_info.sectors_per_fat + sec + fat_info.base_addr, count) == 1)
+            goto write_fat_mirror_err;
+        i++;
+    }
+
+    return 0;
+write_fat_mirror_err:
+    return 1;
+}
+
+// Mark FAT sectors whose copies are behind. Shell and flusher both mark and
+// clear bits, so the update must not be split by a preemption.
+static void fat_mirror_mark(uint32_t sec, uint32_t count)
+{
+    uint32_t i;
+    uint32_t old_ie;
+
+    old_ie = disable_interrupts();
+    for (i = sec; i < sec + count; i++)
+        fat_mirror_dirty[i >> 5] |= 1 << (i & 31);
+    if (old_ie)
+        enable_interrupts();
+}
+
 // Write current fat sector.
 uint32_t write_fat_sector(uint32_t index)
 {
-    if ((fat_buf[index].cur != 0xffffffff) && (((fat_buf[index].state) & 0x02) != 0)) {
-        // Write FAT and FAT copy.
+    uint32_t sec;
+
+    if ((fat_buf[index].cur != 0xffffffff) && (((fat_buf[index].state) & 0x06) != 0)) {
+        // Write active FAT, copies are only marked and synced at checkpoint.
         if (write_block(fat_buf[index].buf, fat_buf[index].cur, 1) == 1)
             goto write_fat_sector_err;
-        if (write_block(fat_buf[index].buf, fat_info.BPB.attr.num_of_sectors_per_fat + fat_buf[index].cur, 1) == 1)
+
+        sec = fat_buf[index].cur - fat_info.base_addr - fat_info.BPB.attr.reserved_sectors - fat_info.active_fat * fat_info.sectors_per_fat;
+        if (fat_mirror_dirty)
+            fat_mirror_mark(sec, 1);
+        else if (write_fat_mirror(fat_buf[index].buf, sec, 1) == 1)
             goto write_fat_sector_err;
+
         fat_buf[index].state &= 0x01;
     }
     return 0;
@@ -144,6 +249,62 @@ write_fat_sector_err:
     return 1;
 }
 
+// Copy FAT sectors already written to the active FAT into its copies.
+// Runs of dirty sectors are copied up to 8 sectors at a time. Bits are
+// cleared before the active FAT is read, so a sector written again
+// meanwhile stays marked. buf holds 8 sectors.
+static uint32_t fs_sync_fat_copies(uint8_t* buf)
+{
+    uint32_t i;
+    uint32_t sec, count;
+    uint32_t old_ie;
+
+    if (fat_mirror_dirty == 0)
+        return 0;
+
+    for (sec = 0; sec < fat_info.sectors_per_fat; sec += count) {
+        if ((fat_mirror_dirty[sec >> 5] & (1 << (sec & 31))) == 0) {
+            // Skip clean words.
+            count = fat_mirror_dirty[sec >> 5] == 0 ? 32 - (sec & 31) : 1;
+            continue;
+        }
+
+        old_ie = disable_interrupts();
+        for (count = 1; count < 8 && sec + count < fat_info.sectors_per_fat; count++)
+            if ((fat_mirror_dirty[(sec + count) >> 5] & (1 << ((sec + count) & 31))) == 0)
+                break;
+        for (i = sec; i < sec + count; i++)
+            fat_mirror_dirty[i >> 5] &= ~(1 << (i & 31));
+        if (old_ie)
+            enable_interrupts();
+
+        if (read_block(buf, fat_info.BPB.attr.reserved_sectors + fat_info.active_fat * fat_info.sectors_per_fat + sec + fat_info.base_addr, count) == 1
+            || write_fat_mirror(buf, sec, count) == 1) {
+            fat_mirror_mark(sec, count);
+            goto fs_sync_fat_copies_err;
+        }
+    }
+
+    return 0;
+fs_sync_fat_copies_err:
+    return 1;
+}
+
+// Checkpoint: write FAT buffers and bring FAT copies up to date with the
+// active FAT.
+uint32_t fs_sync_fat_mirror()
+{
+    uint32_t i;
+
+    for (i = 0; i < FAT_BUF_NUM; i++)
+        if (write_fat_sector(i) == 1)
+            goto fs_sync_fat_mirror_err;
+
+    return fs_sync_fat_copies(fat_mirror_buf);
+fs_sync_fat_mirror_err:
+    return 1;
+}
+
 // Read fat sector.
 uint32_t read_fat_sector(uint32_t ThisFATSecNum)
 {
@@ -180,6 +341,13 @@ uint32_t fs_next_slash(uint8_t* f)
     for (i = 0; (*(f + i) != 0) && (*(f + i) != '/'); i++)
         ;
 
+    // Keep name as given too, in case it does not fit 8.3.
+    for (j = 0; j < i && j < LFN_NAME_MAX; j++)
+        filename_long[j] = f[j];
+    filename_long[j] = 0;
+    filename_long_len = j;
+    filename_lfn = lfn_needed(f, i);
+
     for (j = 0; j < 12; j++) {
         chr11[j] = 0;
         filename11[j] = 0x20;
@@ -220,71 +388,141 @@ uint32_t fs_cmp_filename(const uint8_t* f1, const uint8_t* f2)
     return 0;
 }
 
+// Step to next slot of a directory. Returns 0xffffffff at end of its cluster
+// chain, unless extend is set, then a new empty cluster is appended. Returns
+// 1 on error.
+static uint32_t fs_dir_next_slot(uint32_t* sector, uint32_t* offset, uint32_t extend)
+{
+    uint32_t clus;
+    uint32_t next_clus;
+
+    *offset += 32;
+    if (*offset < 512)
+        return 0;
+    *offset = 0;
+
+    // Next sector in current cluster.
+    if (((*sector - fat_info.first_data_sector + 1) & (fat_info.BPB.attr.sectors_per_cluster - 1)) != 0) {
+        (*sector)++;
+        return 0;
+    }
+
+    // First sector of next cluster.
+    clus = fs_sec2dataclus(*sector);
+    if (get_fat_entry_value(clus, &next_clus) == 1)
+        goto fs_dir_next_slot_err;
+
+    if (next_clus > fat_info.total_data_clusters + 1) {
+        if (!extend)
+            return 0xffffffff;
+
+        // New cluster is erased by fs_alloc, so it reads as end of directory.
+        if (fs_alloc(&next_clus) == 1)
+            goto fs_dir_next_slot_err;
+        if (fs_modify_fat(clus, next_clus) == 1)
+            goto fs_dir_next_slot_err;
+    }
+
+    *sector = fs_dataclus2sec(next_clus);
+    return 0;
+fs_dir_next_slot_err:
+    return 1;
+}
+
+// Look up last path component parsed by fs_next_slash in a directory, by its
+// long name if it needs one. Fills entry of file, where it is and where its
+// long name is. Returns 0 if found, 1 if the directory has no such entry,
+// 0xffffffff if the directory could not be read.
+static uint32_t fs_dir_lookup(FILE* file, uint32_t dir_clus)
+{
+    struct lfn_state lfn;
+    uint8_t* entry;
+    uint32_t sector;
+    uint32_t offset;
+    uint32_t index;
+    uint32_t len;
+    uint32_t k;
+
+    file->dir_entry_pos = 0xFFFFFFFF;
+    file->dir_clus = dir_clus;
+    file->lfn.num = 0;
+
+    // Try name index of directory first, a miss there means no such entry.
+    k = fs_dir_index_find(dir_clus, filename11, filename_lfn ? filename_long : 0, &sector, &offset, &file->lfn);
+    if (k == 1)
+        goto fs_dir_lookup_none;
+
+    // Directory cannot be indexed, scan it, decoding long names on the way.
+    if (k == 0xffffffff) {
+        lfn_reset(&lfn);
+        sector = fs_dataclus2sec(dir_clus);
+        offset = 0;
+
+        while (1) {
+            index = fs_read_512(dir_data_buf, sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+            if (index == 0xffffffff)
+                goto fs_dir_lookup_err;
+
+            entry = dir_data_buf[index].buf + offset;
+            if (entry[0] == 0)
+                goto fs_dir_lookup_none;
+
+            if (entry[0] == 0xE5)
+                lfn_reset(&lfn);
+            else if ((entry[11] & LFN_ATTR) == LFN_ATTR)
+                lfn_collect(&lfn, entry, sector, offset);
+            else if ((entry[11] & 0x08) != 0)
+                lfn_reset(&lfn);
+            else {
+                len = lfn_finish(&lfn, entry);
+                if (filename_lfn) {
+                    if (len == filename_long_len && lfn_cmp(lfn.name, filename_long, len) == 0)
+                        break;
+                } else if (fs_cmp_filename(entry, filename11) == 0)
+                    break;
+            }
+
+            k = fs_dir_next_slot(&sector, &offset, 0);
+            if (k == 0xffffffff)
+                goto fs_dir_lookup_none;
+            if (k == 1)
+                goto fs_dir_lookup_err;
+        }
+
+        file->lfn = lfn.loc;
+    }
+
+    index = fs_read_512(dir_data_buf, sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+    if (index == 0xffffffff)
+        goto fs_dir_lookup_err;
+
+    file->dir_entry_pos = offset;
+    file->dir_entry_sector = sector;
+    for (k = 0; k < 32; k++)
+        file->entry.data[k] = *(dir_data_buf[index].buf + offset + k);
+
+    return 0;
+fs_dir_lookup_none:
+    return 1;
+fs_dir_lookup_err:
+    return 0xffffffff;
+}
+
 // Find a file, only absolute path with starting '/' accepted.
 uint32_t fs_find(FILE* file)
 {
     uint8_t* f = file->path;
     uint32_t next_slash;
-    uint32_t i, k;
-    uint32_t next_clus;
-    uint32_t index;
-    uint32_t sec;
+    uint32_t dir_clus = 2;
 
     if (*(f++) != '/')
         goto fs_find_err;
 
-    index = fs_read_512(dir_data_buf, fs_dataclus2sec(2), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-    // Open root directory.
-    if (index == 0xffffffff)
-        goto fs_find_err;
-
     // Find directory entry.
     while (1) {
-        file->dir_entry_pos = 0xFFFFFFFF;
         next_slash = fs_next_slash(f);
 
-        while (1) {
-            for (sec = 1; sec <= fat_info.BPB.attr.sectors_per_cluster; sec++) {
-                // Find directory entry in current cluster.
-                for (i = 0; i < 512; i += 32) {
-                    if (*(dir_data_buf[index].buf + i) == 0)
-                        goto after_fs_find;
-
-                    // Ignore long path.
-                    if ((fs_cmp_filename(dir_data_buf[index].buf + i, filename11) == 0) && ((*(dir_data_buf[index].buf + i + 11) & 0x08) == 0)) {
-                        file->dir_entry_pos = i;
-                        // refer to the issue in fs_close()
-                        file->dir_entry_sector = dir_data_buf[index].cur - fat_info.base_addr;
-
-                        for (k = 0; k < 32; k++)
-                            file->entry.data[k] = *(dir_data_buf[index].buf + i + k);
-
-                        goto after_fs_find;
-                    }
-                }
-                // Next sector in current cluster.
-                if (sec < fat_info.BPB.attr.sectors_per_cluster) {
-                    index = fs_read_512(dir_data_buf, dir_data_buf[index].cur + 1, &dir_data_clock_head, DIR_DATA_BUF_NUM);
-                    if (index == 0xffffffff)
-                        goto fs_find_err;
-                } else {
-                    // Read next cluster of current directory.
-                    if (get_fat_entry_value(dir_data_buf[index].cur - fat_info.BPB.attr.sectors_per_cluster + 1, &next_clus) == 1)
-                        goto fs_find_err;
-
-                    if (next_clus <= fat_info.total_data_clusters + 1) {
-                        index = fs_read_512(dir_data_buf, fs_dataclus2sec(next_clus), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-                        if (index == 0xffffffff)
-                            goto fs_find_err;
-                    } else
-                        goto after_fs_find;
-                }
-            }
-        }
-
-    after_fs_find:
-        // If not found.
-        if (file->dir_entry_pos == 0xFFFFFFFF)
+        if (fs_dir_lookup(file, dir_clus) != 0)
             goto fs_find_err;
 
         // If path parsing completes.
@@ -298,14 +536,8 @@ uint32_t fs_find(FILE* file)
         f += next_slash + 1;
 
         // Open sub directory, high word(+20), low word(+26).
-        // TODO: confused.
-        next_clus = get_start_cluster(file);
-
-        if (next_clus <= fat_info.total_data_clusters + 1) {
-            index = fs_read_512(dir_data_buf, fs_dataclus2sec(next_clus), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-            if (index == 0xffffffff)
-                goto fs_find_err;
-        } else
+        dir_clus = get_start_cluster(file);
+        if (dir_clus < 2 || dir_clus > fat_info.total_data_clusters + 1)
             goto fs_find_err;
     }
 fs_find_ok:
@@ -319,20 +551,16 @@ uint32_t fs_open(FILE* file, uint8_t* filename)
 {
     uint32_t i;
 
-    // Local buffer initialize.
-    for (i = 0; i < LOCAL_DATA_BUF_NUM; i++) {
-        file->data_buf[i].cur = 0xffffffff;
-        file->data_buf[i].state = 0;
-    }
-
-    file->clock_head = 0;
-
     for (i = 0; i < 256; i++)
         file->path[i] = 0;
     for (i = 0; i < 256 && filename[i] != 0; i++)
         file->path[i] = filename[i];
 
     file->loc = 0;
+    file->ra_next = 0;
+    file->ra_limit = 0;
+    file->ra_window = 0;
+    file->extent_num = 0;
 
     if (fs_find(file) == 1)
         goto fs_open_err;
@@ -342,6 +570,63 @@ fs_open_err:
     return 1;
 }
 
+// Open with directory entry location from path cache, without fs_find.
+// Fails if the entry there is no longer the file named by path. Long name
+// location is only known if path ends with a long name.
+uint32_t fs_open_at(FILE* file, uint8_t* filename, const struct dentry_loc* loc)
+{
+    uint32_t i;
+    uint32_t index;
+    uint32_t sector;
+    uint32_t offset;
+    uint8_t* entry;
+    uint8_t* last = filename;
+
+    for (i = 0; filename[i] != 0; i++)
+        if (filename[i] == '/')
+            last = filename + i + 1;
+
+    index = fs_read_512(dir_data_buf, loc->sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+    if (index == 0xffffffff)
+        goto fs_open_at_err;
+
+    entry = dir_data_buf[index].buf + loc->offset;
+    fs_next_slash(last);
+    if (entry[0] == 0 || entry[0] == 0xE5 || (entry[11] & 0x08) != 0)
+        goto fs_open_at_err;
+
+    // Long name is not in the entry, ask directory index whose entry it is.
+    file->lfn.num = 0;
+    if (filename_lfn) {
+        if (fs_dir_index_find(loc->dir_clus, filename11, filename_long, &sector, &offset, &file->lfn) != 0)
+            goto fs_open_at_err;
+        if (sector != loc->sector || offset != loc->offset)
+            goto fs_open_at_err;
+    } else if (fs_cmp_filename(entry, filename11) != 0)
+        goto fs_open_at_err;
+
+    for (i = 0; i < 256; i++)
+        file->path[i] = 0;
+    for (i = 0; i < 256 && filename[i] != 0; i++)
+        file->path[i] = filename[i];
+
+    file->loc = 0;
+    file->ra_next = 0;
+    file->ra_limit = 0;
+    file->ra_window = 0;
+    file->extent_num = 0;
+
+    file->dir_entry_sector = loc->sector;
+    file->dir_entry_pos = loc->offset;
+    file->dir_clus = loc->dir_clus;
+    for (i = 0; i < 32; i++)
+        file->entry.data[i] = entry[i];
+
+    return 0;
+fs_open_at_err:
+    return 1;
+}
+
 // fflush, write global buffers to sd.
 uint32_t fs_fflush()
 {
@@ -368,6 +653,86 @@ fs_fflush_err:
     return 1;
 }
 
+// Flusher: write one dirty FAT sector. Interrupts are only off while it is
+// copied, the buffer keeps writeback bit set until it is on sd, so it is not
+// reused and read back before that.
+static uint32_t fs_flush_fat_sector(uint32_t index)
+{
+    static uint8_t buf[512];
+    uint32_t cur;
+    uint32_t sec;
+    uint32_t ret;
+    uint32_t old_ie;
+
+    old_ie = disable_interrupts();
+    cur = fat_buf[index].cur;
+    if (cur == 0xffffffff || (fat_buf[index].state & 0x02) == 0) {
+        if (old_ie)
+            enable_interrupts();
+        return 0;
+    }
+    kernel_memcpy(buf, fat_buf[index].buf, 512);
+    fat_buf[index].state = (fat_buf[index].state & 0x01) | 0x04;
+    if (old_ie)
+        enable_interrupts();
+
+    ret = write_block(buf, cur, 1);
+    if (ret == 0) {
+        sec = cur - fat_info.base_addr - fat_info.BPB.attr.reserved_sectors - fat_info.active_fat * fat_info.sectors_per_fat;
+        if (fat_mirror_dirty)
+            fat_mirror_mark(sec, 1);
+        else
+            ret = write_fat_mirror(buf, sec, 1);
+    }
+
+    old_ie = disable_interrupts();
+    if (fat_buf[index].cur == cur) {
+        fat_buf[index].state &= ~0x04;
+        if (ret == 1)
+            fat_buf[index].state |= 0x02;
+    }
+    if (old_ie)
+        enable_interrupts();
+
+    return ret;
+}
+
+// Flusher thread: write dirty buffers back in background, so fs_read and
+// fs_write rarely have to write a victim before reusing it.
+void fs_flusher()
+{
+    uint32_t pass = 0;
+    uint32_t mirror_pass = 0;
+    uint32_t i;
+
+    while (1) {
+        call_syscall_a0(SYSCALL_SLEEP, FS_FLUSH_INTERVAL);
+
+        // Nothing cached before fs is mounted.
+        if (fat_info.BPB.attr.sectors_per_cluster == 0)
+            continue;
+
+        if (fs_flush_4k(0) == 1)
+            log(LOG_FAIL, "fs flusher: write cluster fail.");
+
+        // Periodic checkpoint of FAT copies, of sectors flushed before.
+        if (++mirror_pass >= FS_MIRROR_INTERVAL / FS_FLUSH_INTERVAL) {
+            mirror_pass = 0;
+            if (fs_sync_fat_copies(fat_flush_mirror_buf) == 1)
+                log(LOG_FAIL, "fs flusher: sync FAT copies fail.");
+        }
+
+        // FAT sectors have no age of their own, write them every dirty age.
+        if (++pass < FS_DIRTY_AGE / FS_FLUSH_INTERVAL)
+            continue;
+        pass = 0;
+
+        for (i = 0; i < FAT_BUF_NUM; i++)
+            if (fs_flush_fat_sector(i) == 1)
+                log(LOG_FAIL, "fs flusher: write FAT sector fail.");
+    }
+}
+
 // Close: write all buf in memory to sd.
 uint32_t fs_close(FILE* file)
 {
@@ -386,26 +751,193 @@ uint32_t fs_close(FILE* file)
     // Do fflush to write global buffers.
     if (fs_fflush() == 1)
         goto fs_close_err;
-    // Write local data buffer.
-    for (i = 0; i < LOCAL_DATA_BUF_NUM; i++)
-        if (fs_write_4k(file->data_buf + i) == 1)
-            goto fs_close_err;
+    // Write cluster cache.
+    if (fs_fflush_4k() == 1)
+        goto fs_close_err;
 
     return 0;
 fs_close_err:
     return 1;
 }
 
+// Record that logical cluster is stored in data cluster clus.
+static void fs_extent_add(FILE* file, uint32_t logical, uint32_t clus)
+{
+    struct fat_extent* last = file->extent + file->extent_num - 1;
+
+    // Extend last run if contiguous on disk.
+    if (file->extent_num != 0 && last->logical + last->len == logical && last->start + last->len == clus) {
+        last->len++;
+        return;
+    }
+
+    // If map is full, last slot keeps following the chain.
+    if (file->extent_num < FILE_EXTENT_NUM) {
+        last++;
+        file->extent_num++;
+    }
+
+    last->logical = logical;
+    last->start = clus;
+    last->len = 1;
+}
+
+// Map logical cluster to data cluster, 0xffffffff if beyond chain end.
+static uint32_t fs_get_cluster(FILE* file, uint32_t logical, uint32_t* clus)
+{
+    struct fat_extent* last;
+    uint32_t next_clus;
+    uint32_t cur, cur_clus;
+    uint32_t i;
+
+    for (i = 0; i < file->extent_num; i++) {
+        if (logical >= file->extent[i].logical && logical < file->extent[i].logical + file->extent[i].len) {
+            *clus = file->extent[i].start + logical - file->extent[i].logical;
+            return 0;
+        }
+    }
+
+    // Walk from the end of last run, restart if the run was overwritten.
+    last = file->extent + file->extent_num - 1;
+    if (file->extent_num == 0 || logical < last->logical) {
+        file->extent_num = 0;
+        fs_extent_add(file, 0, get_start_cluster(file));
+        last = file->extent;
+    }
+
+    cur = last->logical + last->len - 1;
+    cur_clus = last->start + last->len - 1;
+    while (cur < logical) {
+        if (get_fat_entry_value(cur_clus, &next_clus) == 1)
+            goto fs_get_cluster_err;
+
+        if (next_clus > fat_info.total_data_clusters + 1) {
+            *clus = 0xffffffff;
+            return 0;
+        }
+
+        cur++;
+        cur_clus = next_clus;
+        fs_extent_add(file, cur, cur_clus);
+    }
+
+    *clus = cur_clus;
+    return 0;
+fs_get_cluster_err:
+    return 1;
+}
+
+// Extend file chain up to logical cluster for writing.
+// Clusters are allocated as contiguous runs sized to the write. Nothing is
+// written or cached for them here, the writer claims their buffers with
+// fs_clr_4k. first_new is set to the first new logical cluster, 0xffffffff
+// if the chain was long enough.
+static uint32_t fs_extend_chain(FILE* file, uint32_t logical, uint32_t* first_new)
+{
+    struct fat_extent* last;
+    uint32_t tail, tail_clus;
+    uint32_t new_clus, run;
+    uint32_t i;
+
+    *first_new = 0xffffffff;
+
+    // Empty file has no cluster yet.
+    if (get_start_cluster(file) == 0) {
+        tail = 0xffffffff;
+        tail_clus = 0;
+        file->extent_num = 0;
+    } else {
+        if (fs_get_cluster(file, logical, &new_clus) == 1)
+            goto fs_extend_chain_err;
+
+        if (new_clus != 0xffffffff)
+            return 0;
+
+        // Chain has been walked to its end, so last run ends at the tail.
+        last = file->extent + file->extent_num - 1;
+        tail = last->logical + last->len - 1;
+        tail_clus = last->start + last->len - 1;
+    }
+
+    if (tail + 1 <= logical)
+        *first_new = tail + 1;
+
+    while (tail + 1 <= logical) {
+        // Prefer clusters right after the tail to keep file contiguous.
+        if (fs_alloc_run(tail_clus == 0 ? 0 : tail_clus + 1, logical - tail, &new_clus, &run) == 1)
+            goto fs_extend_chain_err;
+
+        if (tail_clus == 0) {
+            file->entry.attr.starthi = (uint16_t)(((new_clus >> 16) & 0xFFFF));
+            file->entry.attr.startlow = (uint16_t)((new_clus & 0xFFFF));
+        } else if (fs_modify_fat(tail_clus, new_clus) == 1)
+            goto fs_extend_chain_err;
+
+        for (i = 0; i < run; i++) {
+            tail++;
+            fs_extent_add(file, tail, new_clus + i);
+        }
+
+        tail_clus = new_clus + run - 1;
+    }
+
+    return 0;
+fs_extend_chain_err:
+    return 1;
+}
+
+// Prefetch clusters after a sequential read into cluster cache. The reads
+// are only queued, the sd elevator runs them from its interrupt while the
+// caller goes on, and merges adjacent ones up to what one command moves.
+// A later fs_read waits on a cluster only if its read has not landed yet.
+static uint32_t fs_readahead(FILE* file, uint32_t end_clus)
+{
+    uint32_t last_clus = (file->entry.attr.size - 1) >> fs_wa(fat_info.BPB.attr.sectors_per_cluster << 9);
+    uint32_t limit = end_clus + 1 + file->ra_window;
+    uint32_t clus;
+    uint32_t i;
+
+    // Still enough prefetched clusters ahead of the reader.
+    if (file->ra_limit > end_clus + 1 + (file->ra_window >> 1))
+        return 0;
+
+    if (limit > last_clus + 1)
+        limit = last_clus + 1;
+
+    if (file->ra_limit < end_clus + 1)
+        file->ra_limit = end_clus + 1;
+
+    // Extent map walks the chain once, queue every cluster not prefetched before.
+    for (i = file->ra_limit; i < limit; i++) {
+        if (fs_get_cluster(file, i, &clus) == 1)
+            goto fs_readahead_err;
+
+        if (clus == 0xffffffff)
+            break;
+
+        if (fs_prefetch_4k(fs_dataclus2sec(clus)) == 1)
+            goto fs_readahead_err;
+    }
+
+    file->ra_limit = i;
+    return 0;
+fs_readahead_err:
+    file->ra_window = 0;
+    return 1;
+}
+
 // Read from file.
 uint32_t fs_read(FILE* file, uint8_t* buf, uint32_t count)
 {
     uint32_t start_clus, start_byte;
     uint32_t end_clus, end_byte;
     uint32_t filesize = file->entry.attr.size;
+    uint32_t cluster_size = fat_info.BPB.attr.sectors_per_cluster << 9;
     uint32_t clus = get_start_cluster(file);
     uint32_t next_clus;
-    uint32_t i;
+    uint32_t run;
     uint32_t cc;
+    uint32_t n;
     uint32_t index;
 
 #ifdef FS_DEBUG
@@ -436,41 +968,62 @@ uint32_t fs_read(FILE* file, uint8_t* buf, uint32_t count)
     kernel_printf("end cluster: %d\n", end_clus);
     kernel_printf("end byte: %d\n", end_byte);
 #endif // ! FS_DEBUG
-    // Open first cluster to read.
-    for (i = 0; i < start_clus; i++) {
-        if (get_fat_entry_value(clus, &next_clus) == 1)
-            goto fs_read_err;
-
-        clus = next_clus;
+    // Grow read-ahead window on sequential access, collapse it on seeks.
+    if (start_clus == file->ra_next || start_clus == file->ra_next + 1) {
+        file->ra_window <<= 1;
+        if (file->ra_window < FS_READAHEAD_MIN)
+            file->ra_window = FS_READAHEAD_MIN;
+        if (file->ra_window > FS_READAHEAD_MAX)
+            file->ra_window = FS_READAHEAD_MAX;
+    } else {
+        file->ra_window = 0;
+        file->ra_limit = 0;
     }
 
     cc = 0;
     while (start_clus <= end_clus) {
-        index = fs_read_4k(file->data_buf, fs_dataclus2sec(clus), &(file->clock_head), LOCAL_DATA_BUF_NUM);
-        if (index == 0xffffffff)
+        if (fs_get_cluster(file, start_clus, &clus) == 1 || clus == 0xffffffff)
             goto fs_read_err;
 
-        // If in same cluster, just read.
-        if (start_clus == end_clus) {
-            for (i = start_byte; i <= end_byte; i++)
-                buf[cc++] = file->data_buf[index].buf[i];
-            goto fs_read_end;
-        }
-        // Otherwise, read clusters one by one.
-        else {
-            for (i = start_byte; i < (fat_info.BPB.attr.sectors_per_cluster << 9); i++)
-                buf[cc++] = file->data_buf[index].buf[i];
-
-            start_clus++;
-            start_byte = 0;
+        // Whole clusters not in cache go from sd straight into buf, a run
+        // of contiguous ones with one request. The sd driver copies words,
+        // so buf must be word aligned there.
+        if (start_byte == 0 && ((uint32_t)(buf + cc) & 3) == 0 && (start_clus < end_clus || end_byte == cluster_size - 1) && fs_lookup_4k(fs_dataclus2sec(clus)) == 0xffffffff) {
+            run = 1;
+            while (start_clus + run < end_clus || (start_clus + run == end_clus && end_byte == cluster_size - 1)) {
+                if (fs_get_cluster(file, start_clus + run, &next_clus) == 1)
+                    goto fs_read_err;
+                if (next_clus != clus + run || fs_lookup_4k(fs_dataclus2sec(next_clus)) != 0xffffffff)
+                    break;
+                run++;
+            }
 
-            if (get_fat_entry_value(clus, &next_clus) == 1)
+            if (read_block(buf + cc, fs_dataclus2sec(clus) + fat_info.base_addr, run * fat_info.BPB.attr.sectors_per_cluster) == 1)
                 goto fs_read_err;
 
-            clus = next_clus;
+            cc += run * cluster_size;
+            start_clus += run;
+            continue;
         }
+
+        index = fs_read_4k(fs_dataclus2sec(clus));
+        if (index == 0xffffffff)
+            goto fs_read_err;
+
+        // Copy up to end of cluster, or end of read in last one.
+        n = (start_clus == end_clus ? end_byte + 1 : cluster_size) - start_byte;
+        kernel_memcpy(buf + cc, fscache_4k[index].buf + start_byte, n);
+
+        cc += n;
+        start_clus++;
+        start_byte = 0;
     }
-fs_read_end:
+
+    file->ra_next = end_clus;
+
+    // Prefetch failure does not affect data already read.
+    if (file->ra_window != 0)
+        fs_readahead(file, end_clus);
 
 #ifdef FS_DEBUG
     kernel_printf("fs_read: count %d\n", count);
@@ -491,6 +1044,11 @@ uint32_t fs_next_free(uint32_t start, uint32_t* next_free)
 
     *next_free = 0xFFFFFFFF;
 
+    if (fs_bitmap_ready()) {
+        *next_free = fs_bitmap_next_free(start);
+        return 0;
+    }
+
     for (clus = start; clus <= fat_info.total_data_clusters + 1; clus++) {
         if (get_fat_entry_value(clus, &ClusEntryVal) == 1)
             goto fs_next_free_err;
@@ -506,40 +1064,70 @@ fs_next_free_err:
     return 1;
 }
 
-// Alloc a new free data cluster.
-uint32_t fs_alloc(uint32_t* new_alloc)
+// Alloc up to want contiguous free clusters starting near hint, linked as one chain.
+// Returns the first cluster and the number actually allocated, at least 1.
+uint32_t fs_alloc_run(uint32_t hint, uint32_t want, uint32_t* start, uint32_t* len)
 {
     uint32_t clus;
-    uint32_t next_free;
+    uint32_t run;
+    uint32_t i;
 
-    clus = get_uint32_t(fat_info.fat_fs_info + 492) + 1;
+    // FSI_Nxt_Free keeps the last allocated cluster, search after it.
+    if (hint == 0)
+        hint = get_uint32_t(fat_info.fat_fs_info + 492) + 1;
+    if (hint < 2 || hint > fat_info.total_data_clusters + 1)
+        hint = 2;
 
-    // If FSI_Nxt_Free is illegal (> FSI_Free_Count), find a free data cluster from beginning.
-    if (clus > get_uint32_t(fat_info.fat_fs_info + 488) + 1) {
+    if (fs_next_free(hint, &clus) == 1)
+        goto fs_alloc_run_err;
+
+    // Wrap around to the beginning.
+    if (clus > fat_info.total_data_clusters + 1) {
         if (fs_next_free(2, &clus) == 1)
-            goto fs_alloc_err;
+            goto fs_alloc_run_err;
+    }
 
-        if (fs_modify_fat(clus, 0xFFFFFFFF) == 1)
-            goto fs_alloc_err;
+    // No available free cluster.
+    if (clus > fat_info.total_data_clusters + 1)
+        goto fs_alloc_run_err;
+
+    // Grow run while following clusters are free, only bitmap makes this cheap.
+    run = 1;
+    if (fs_bitmap_ready()) {
+        while (run < want && clus + run <= fat_info.total_data_clusters + 1 && fs_bitmap_is_free(clus + run))
+            run++;
     }
 
-    // FAT allocated and update FSI_Nxt_Free.
-    if (fs_modify_fat(clus, 0xFFFFFFFF) == 1)
-        goto fs_alloc_err;
+    // Link the run in one pass, entries mostly share a FAT sector.
+    for (i = 0; i + 1 < run; i++)
+        if (fs_modify_fat(clus + i, clus + i + 1) == 1)
+            goto fs_alloc_run_err;
 
-    if (fs_next_free(clus, &next_free) == 1)
-        goto fs_alloc_err;
+    if (fs_modify_fat(clus + run - 1, 0xFFFFFFFF) == 1)
+        goto fs_alloc_run_err;
 
-    // No available free cluster.
-    if (next_free > fat_info.total_data_clusters + 1)
-        goto fs_alloc_err;
+    set_uint32_t(fat_info.fat_fs_info + 492, clus + run - 1);
 
-    set_uint32_t(fat_info.fat_fs_info + 492, next_free - 1);
+    *start = clus;
+    *len = run;
+    return 0;
+fs_alloc_run_err:
+    return 1;
+}
+
+// Alloc a new free data cluster.
+uint32_t fs_alloc(uint32_t* new_alloc)
+{
+    uint32_t clus;
+    uint32_t run;
+
+    if (fs_alloc_run(0, 1, &clus, &run) == 1)
+        goto fs_alloc_err;
 
     *new_alloc = clus;
 
     // Erase new allocated cluster.
-    if (write_block(new_alloc_empty, fs_dataclus2sec(clus), fat_info.BPB.attr.sectors_per_cluster) == 1)
+    if (write_block(new_alloc_empty, fs_dataclus2sec(clus) + fat_info.base_addr, fat_info.BPB.attr.sectors_per_cluster) == 1)
         goto fs_alloc_err;
 
     return 0;
@@ -568,82 +1156,42 @@ uint32_t fs_write(FILE* file, const uint8_t* buf, uint32_t count)
     kernel_printf("end byte: %d\n", end_byte);
 #endif
 
-    // If file is empty, alloc a new data cluster.
-    uint32_t curr_cluster = get_start_cluster(file);
-    if (curr_cluster == 0) {
-        if (fs_alloc(&curr_cluster) == 1) {
-            goto fs_write_err;
-        }
-        file->entry.attr.starthi = (uint16_t)(((curr_cluster >> 16) & 0xFFFF));
-        file->entry.attr.startlow = (uint16_t)((curr_cluster & 0xFFFF));
-        if (fs_clr_4k(file->data_buf, &(file->clock_head), LOCAL_DATA_BUF_NUM, fs_dataclus2sec(curr_cluster)) == 1)
-            goto fs_write_err;
-    }
-
-    // Open first cluster to read.
-    uint32_t next_cluster;
-    for (uint32_t i = 0; i < start_clus; i++) {
-        if (get_fat_entry_value(curr_cluster, &next_cluster) == 1)
-            goto fs_write_err;
-
-        // If this is the last cluster in file, and still need to open next cluster, just alloc a new data cluster.
-        if (next_cluster > fat_info.total_data_clusters + 1) {
-            if (fs_alloc(&next_cluster) == 1)
-                goto fs_write_err;
+    uint32_t first_new;
 
-            if (fs_modify_fat(curr_cluster, next_cluster) == 1)
-                goto fs_write_err;
-
-            if (fs_clr_4k(file->data_buf, &(file->clock_head), LOCAL_DATA_BUF_NUM, fs_dataclus2sec(next_cluster)) == 1)
-                goto fs_write_err;
-        }
-
-        curr_cluster = next_cluster;
-    }
+    // If file is shorter, extend its chain for the whole write at once.
+    if (fs_extend_chain(file, end_clus, &first_new) == 1)
+        goto fs_write_err;
 
+    uint32_t curr_cluster;
     uint32_t cc = 0;
+    uint32_t n;
     uint32_t index = 0;
     while (start_clus <= end_clus) {
-        index = fs_read_4k(file->data_buf, fs_dataclus2sec(curr_cluster), &(file->clock_head), LOCAL_DATA_BUF_NUM);
-        if (index == 0xffffffff)
+        if (fs_get_cluster(file, start_clus, &curr_cluster) == 1 || curr_cluster == 0xffffffff)
             goto fs_write_err;
 
-        file->data_buf[index].state = 3;
+        // Copy up to end of cluster, or end of write in last one.
+        n = (start_clus == end_clus ? end_byte + 1 : (fat_info.BPB.attr.sectors_per_cluster << 9)) - start_byte;
 
-        // If in same cluster, just write.
-        if (start_clus == end_clus) {
-            for (uint32_t i = start_byte; i <= end_byte; i++)
-                file->data_buf[index].buf[i] = buf[cc++];
-            goto fs_write_end;
-        }
-        // Otherwise, write clusters one by one.
-        else {
-            for (uint32_t i = start_byte; i < (fat_info.BPB.attr.sectors_per_cluster << 9); i++)
-                file->data_buf[index].buf[i] = buf[cc++];
-
-            start_clus++;
-            start_byte = 0;
-
-            if (get_fat_entry_value(curr_cluster, &next_cluster) == 1)
-                goto fs_write_err;
-
-            // If this is the last cluster in file, and still need to open next cluster, just alloc a new data cluster.
-            if (next_cluster > fat_info.total_data_clusters + 1) {
-                if (fs_alloc(&next_cluster) == 1)
-                    goto fs_write_err;
-
-                if (fs_modify_fat(curr_cluster, next_cluster) == 1)
-                    goto fs_write_err;
+        // New clusters hold garbage on sd, so they are not read. Their
+        // buffers are claimed only now, and only what the write leaves
+        // uncovered is zeroed.
+        if (start_clus >= first_new)
+            index = fs_clr_4k(fs_dataclus2sec(curr_cluster), start_byte, start_byte + n);
+        else
+            index = fs_read_4k(fs_dataclus2sec(curr_cluster));
+        if (index == 0xffffffff)
+            goto fs_write_err;
 
-                if (fs_clr_4k(file->data_buf, &(file->clock_head), LOCAL_DATA_BUF_NUM, fs_dataclus2sec(next_cluster)) == 1)
-                    goto fs_write_err;
-            }
+        // Mark dirty after copy, so flusher never cleans a half written cluster.
+        kernel_memcpy(fscache_4k[index].buf + start_byte, (void*)(buf + cc), n);
+        fs_dirty_4k(index);
 
-            curr_cluster = next_cluster;
-        }
+        cc += n;
+        start_clus++;
+        start_byte = 0;
     }
 
-fs_write_end:
     // Update file size.
     if (file->loc + count > file->entry.attr.size)
         file->entry.attr.size = file->loc + count;
@@ -656,6 +1204,40 @@ fs_write_err:
     return 0xFFFFFFFF;
 }
 
+// Copy whole content of src into dst from its beginning.
+// Data moves cluster by cluster inside cluster cache, so memory use does not
+// depend on file size, and flusher writes dst back while src is still read.
+uint32_t fs_copy(FILE* dst, FILE* src)
+{
+    uint32_t filesize = src->entry.attr.size;
+    uint32_t src_clus, dst_clus;
+    uint32_t logical;
+    uint32_t first_new;
+
+    for (logical = 0; (logical << fs_wa(fat_info.BPB.attr.sectors_per_cluster << 9)) < filesize; logical++) {
+        if (fs_get_cluster(src, logical, &src_clus) == 1 || src_clus == 0xffffffff)
+            goto fs_copy_err;
+
+        // Whole cluster is overwritten, no need to erase it on sd.
+        if (fs_extend_chain(dst, logical, &first_new) == 1)
+            goto fs_copy_err;
+
+        if (fs_get_cluster(dst, logical, &dst_clus) == 1 || dst_clus == 0xffffffff)
+            goto fs_copy_err;
+
+        if (fs_copy_4k(fs_dataclus2sec(src_clus), fs_dataclus2sec(dst_clus)) == 0xffffffff)
+            goto fs_copy_err;
+    }
+
+    if (filesize > dst->entry.attr.size)
+        dst->entry.attr.size = filesize;
+    dst->loc = filesize;
+
+    return 0;
+fs_copy_err:
+    return 1;
+}
+
 // lseek
 void fs_lseek(FILE* file, uint32_t new_loc)
 {
@@ -667,58 +1249,109 @@ void fs_lseek(FILE* file, uint32_t new_loc)
         file->loc = filesize;
 }
 
-// Find an empty directory entry.
-uint32_t fs_find_empty_entry(uint32_t* empty_entry, uint32_t index)
+// Find count empty slots in a row for a new entry and its long name,
+// extending directory if needed. Keeps directory index consistent: slots
+// at end of directory move its end, deleted slots it still lists as free
+// make it stale.
+static uint32_t fs_find_empty_run(uint32_t dir_clus, uint32_t count, uint32_t* sector, uint32_t* offset)
 {
-    uint32_t i;
-    uint32_t next_clus;
-    uint32_t sec;
+    uint32_t cur_sector = fs_dataclus2sec(dir_clus);
+    uint32_t cur_offset = 0;
+    uint32_t run = 0;
+    uint32_t index;
+    uint8_t c;
 
     while (1) {
-        for (sec = 1; sec <= fat_info.BPB.attr.sectors_per_cluster; sec++) {
-            // Find directory entry in current cluster.
-            for (i = 0; i < 512; i += 32) {
-                // If entry is empty.
-                if ((*(dir_data_buf[index].buf + i) == 0) || (*(dir_data_buf[index].buf + i) == 0xE5)) {
-                    *empty_entry = i;
-                    goto after_fs_find_empty_entry;
-                }
+        index = fs_read_512(dir_data_buf, cur_sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+        if (index == 0xffffffff)
+            goto fs_find_empty_run_err;
+
+        c = *(dir_data_buf[index].buf + cur_offset);
+        if (c == 0 || c == 0xE5) {
+            if (run++ == 0) {
+                *sector = cur_sector;
+                *offset = cur_offset;
             }
+        } else
+            run = 0;
+
+        if (run == count)
+            break;
+
+        if (fs_dir_next_slot(&cur_sector, &cur_offset, 1) == 1)
+            goto fs_find_empty_run_err;
+    }
+
+    index = fs_read_512(dir_data_buf, *sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+    if (index == 0xffffffff)
+        goto fs_find_empty_run_err;
 
-            if (sec < fat_info.BPB.attr.sectors_per_cluster) {
-                index = fs_read_512(dir_data_buf, dir_data_buf[index].cur + sec, &dir_data_clock_head, DIR_DATA_BUF_NUM);
-                if (index == 0xffffffff)
-                    goto fs_find_empty_entry_err;
-            } else {
-                // Read next cluster of current directory.
-                if (get_fat_entry_value(dir_data_buf[index].cur - fat_info.BPB.attr.sectors_per_cluster + 1, &next_clus) == 1)
-                    goto fs_find_empty_entry_err;
+    if (*(dir_data_buf[index].buf + *offset) == 0)
+        fs_dir_index_set_end(dir_clus, cur_sector, cur_offset);
+    else
+        fs_dir_index_drop(dir_clus);
 
-                // Need to alloc a new cluster.
-                if (next_clus > fat_info.total_data_clusters + 1) {
-                    if (fs_alloc(&next_clus) == 1)
-                        goto fs_find_empty_entry_err;
+    return 0;
+fs_find_empty_run_err:
+    return 1;
+}
 
-                    if (fs_modify_fat(fs_sec2dataclus(dir_data_buf[index].cur - fat_info.BPB.attr.sectors_per_cluster + 1), next_clus) == 1)
-                        goto fs_find_empty_entry_err;
+// Point ".." of an open directory to the directory holding it, 0 for root.
+// It is the second entry of the first sector, if the directory has one.
+uint32_t fs_set_dotdot(FILE* dir)
+{
+    uint32_t clus = get_start_cluster(dir);
+    uint32_t parent = dir->dir_clus == 2 ? 0 : dir->dir_clus;
+    uint32_t index;
+    uint8_t* entry;
 
-                    *empty_entry = 0;
+    if (clus == 0)
+        return 0;
 
-                    if (fs_clr_512(dir_data_buf, &dir_data_clock_head, DIR_DATA_BUF_NUM, fs_dataclus2sec(next_clus)) == 1)
-                        goto fs_find_empty_entry_err;
-                }
+    index = fs_read_512(dir_data_buf, fs_dataclus2sec(clus), &dir_data_clock_head, DIR_DATA_BUF_NUM);
+    if (index == 0xffffffff)
+        goto fs_set_dotdot_err;
 
-                index = fs_read_512(dir_data_buf, fs_dataclus2sec(next_clus), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-                if (index == 0xffffffff)
-                    goto fs_find_empty_entry_err;
-            }
-        }
+    entry = dir_data_buf[index].buf + 32;
+    if (fs_cmp_filename(entry, (const uint8_t*)"..         ") != 0 || (entry[11] & 0x10) == 0)
+        return 0;
+
+    entry[20] = (parent >> 16) & 0xff;
+    entry[21] = (parent >> 24) & 0xff;
+    entry[26] = parent & 0xff;
+    entry[27] = (parent >> 8) & 0xff;
+    dir_data_buf[index].state = 3;
+
+    return 0;
+fs_set_dotdot_err:
+    return 1;
+}
+
+// Free long name entries of an open file, after its entry is deleted.
+uint32_t fs_del_lfn(FILE* file)
+{
+    uint32_t sector = file->lfn.sector;
+    uint32_t offset = file->lfn.offset;
+    uint32_t index;
+    uint32_t i;
+
+    for (i = 0; i < file->lfn.num; i++) {
+        index = fs_read_512(dir_data_buf, sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+        if (index == 0xffffffff)
+            goto fs_del_lfn_err;
+
+        *(dir_data_buf[index].buf + offset) = 0xE5;
+        dir_data_buf[index].state = 3;
+        fs_dir_index_add_free(file->dir_clus, sector, offset);
+
+        if (i + 1 < file->lfn.num && fs_dir_next_slot(&sector, &offset, 0) != 0)
+            goto fs_del_lfn_err;
     }
 
-after_fs_find_empty_entry:
-    return index;
-fs_find_empty_entry_err:
-    return 0xffffffff;
+    file->lfn.num = 0;
+    return 0;
+fs_del_lfn_err:
+    return 1;
 }
 
 // Create an empty file with attr.
@@ -728,8 +1361,15 @@ uint32_t fs_create_with_attr(uint8_t* filename, uint8_t attr)
     uint32_t l1 = 0;
     uint32_t l2 = 0;
     uint32_t empty_entry;
+    uint32_t sector;
     uint32_t clus;
     uint32_t index;
+    uint32_t n;
+    uint8_t name11[12];
+    uint8_t lname[LFN_NAME_MAX + 1];
+    uint32_t llen = 0;
+    uint8_t checksum;
+    struct lfn_loc lfn;
     FILE file_creat;
 
     // If file exists.
@@ -757,38 +1397,74 @@ uint32_t fs_create_with_attr(uint8_t* filename, uint8_t attr)
             goto fs_creat_err;
 
         clus = get_start_cluster(&file_creat);
-        // Open that directory.
-        index = fs_read_512(dir_data_buf, fs_dataclus2sec(clus), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-        if (index == 0xffffffff)
-            goto fs_creat_err;
+    }
+    // Otherwise, use root directory.
+    else
+        clus = 2;
 
-        file_creat.dir_entry_pos = clus;
+    for (i = l1 + 1; i <= l2; i++)
+        file_creat.path[i - l1 - 1] = filename[i];
+
+    file_creat.path[l2 - l1] = 0;
+    fs_next_slash(file_creat.path);
+
+    // Name that does not fit 8.3 gets long name entries and a unique alias.
+    lfn.num = 0;
+    if (filename_lfn) {
+        llen = filename_long_len;
+        for (i = 0; i <= llen; i++)
+            lname[i] = filename_long[i];
+        lfn.num = (llen + LFN_CHARS - 1) / LFN_CHARS;
+
+        // Alias is free only if the directory was read and has no such entry.
+        for (n = 1;; n++) {
+            if (n == 1000000)
+                goto fs_creat_err;
+            lfn_alias(lname, llen, n, filename11);
+            filename_lfn = 0;
+            index = fs_dir_lookup(&file_creat, clus);
+            if (index == 0xffffffff)
+                goto fs_creat_err;
+            if (index == 1)
+                break;
+        }
     }
-    // Otherwise, open root directory.
-    else {
-        index = fs_read_512(dir_data_buf, fs_dataclus2sec(2), &dir_data_clock_head, DIR_DATA_BUF_NUM);
-        if (index == 0xffffffff)
+    for (i = 0; i < 12; i++)
+        name11[i] = filename11[i];
+
+    // Take slots the directory index knows to be free, otherwise scan that
+    // directory for them.
+    if (fs_dir_index_take_free(clus, lfn.num + 1, &sector, &empty_entry) == 1)
+        if (fs_find_empty_run(clus, lfn.num + 1, &sector, &empty_entry) == 1)
             goto fs_creat_err;
 
-        file_creat.dir_entry_pos = 2;
+    // Long name entries come first, last part of name first.
+    lfn.sector = sector;
+    lfn.offset = empty_entry;
+    if (lfn.num != 0) {
+        checksum = lfn_checksum(name11);
+        for (n = lfn.num; n > 0; n--) {
+            index = fs_read_512(dir_data_buf, sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
+            if (index == 0xffffffff)
+                goto fs_creat_err;
+
+            lfn_fill_entry(dir_data_buf[index].buf + empty_entry, lname, llen, n, lfn.num, checksum);
+            dir_data_buf[index].state = 3;
+
+            if (fs_dir_next_slot(&sector, &empty_entry, 0) != 0)
+                goto fs_creat_err;
+        }
     }
 
-    // Find an empty entry.
-    index = fs_find_empty_entry(&empty_entry, index);
+    index = fs_read_512(dir_data_buf, sector, &dir_data_clock_head, DIR_DATA_BUF_NUM);
     if (index == 0xffffffff)
         goto fs_creat_err;
 
-    for (i = l1 + 1; i <= l2; i++)
-        file_creat.path[i - l1 - 1] = filename[i];
-
-    file_creat.path[l2 - l1] = 0;
-    fs_next_slash(file_creat.path);
-
     dir_data_buf[index].state = 3;
 
     // Write path.
     for (i = 0; i < 11; i++)
-        *(dir_data_buf[index].buf + empty_entry + i) = filename11[i];
+        *(dir_data_buf[index].buf + empty_entry + i) = name11[i];
 
     // Write file attr.
     *(dir_data_buf[index].buf + empty_entry + 11) = attr;
@@ -825,6 +1501,8 @@ uint32_t fs_create_with_attr(uint8_t* filename, uint8_t attr)
     *(dir_data_buf[index].buf + empty_entry + 30) = 0;
     *(dir_data_buf[index].buf + empty_entry + 31) = 0;
 
+    fs_dir_index_add(clus, name11, lfn.num ? lname : 0, sector, empty_entry, &lfn);
+
     if (fs_fflush() == 1)
         goto fs_creat_err;
 
@@ -7,11 +7,24 @@
 #define PAGE_SIZE (1 << PAGE_SHIFT)
 
 #define FAT_BUF_NUM 2
+
+/* Write FAT copies together with the active FAT instead of at checkpoints */
+// #define FS_FAT_MIRROR_SYNC
+
+/* Read-ahead window bounds, in clusters */
+#define FS_READAHEAD_MIN 2
+#define FS_READAHEAD_MAX 8
 extern BUF_512 fat_buf[FAT_BUF_NUM];
 
 extern struct fs_info fat_info;
 
 uint32_t fs_create_with_attr(uint8_t* filename, uint8_t attr);
+uint32_t fs_alloc(uint32_t* new_alloc);
+uint32_t fs_alloc_run(uint32_t hint, uint32_t want, uint32_t* start, uint32_t* len);
 uint32_t read_fat_sector(uint32_t ThisFATSecNum);
+uint32_t fs_sync_fat_mirror();
+uint32_t fs_cmp_filename(const uint8_t* f1, const uint8_t* f2);
+uint32_t fs_del_lfn(FILE* file);
+uint32_t fs_set_dotdot(FILE* dir);
 
 #endif
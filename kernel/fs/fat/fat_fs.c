@@ -1,3 +1,4 @@
+#include "fat.h"
 #include <assert.h>
 #include <kern/errno.h>
 #include <xsu/fs/fat.h>
@@ -26,6 +27,11 @@ static int fat_sync(struct fs* fs)
         VOP_FSYNC(v);
     }
 
+    // Checkpoint, FAT copies are only written here.
+    if (fs_sync_fat_mirror() == 1) {
+        return EIO;
+    }
+
     return 0;
 }
 
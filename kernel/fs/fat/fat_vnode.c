@@ -1,6 +1,7 @@
 #include <kern/errno.h>
 #include <xsu/fs/fat.h>
 #include <xsu/fs/fcntl.h>
+#include <xsu/fs/vfs.h>
 #include <xsu/log.h>
 #include <xsu/slab.h>
 #include <xsu/stat.h>
@@ -104,6 +105,24 @@ static int fat_read(struct vnode* v, unsigned char* buf, unsigned long count)
     return result;
 }
 
+/*
+ * Called for getdirentry(), fills uio with as many entries as fit.
+ */
+static int fat_getdirentry(struct vnode* v, struct uio* uio)
+{
+    FS_FAT_DIR* dir = v->vn_data;
+
+    if (dir == NULL) {
+        return EINVAL;
+    }
+
+    if (fs_read_dirents(dir, uio)) {
+        return EIO;
+    }
+
+    return 0;
+}
+
 /*
  * Called for write().
  */
@@ -498,7 +517,7 @@ static const struct vnode_ops fat_dirops = {
 
     ISDIR, /* read */
     ISDIR, /* readlink */
-    UNIMP,
+    fat_getdirentry,
     ISDIR, /* write */
     fat_ioctl,
     fat_stat,
@@ -528,7 +547,7 @@ struct vnode* fat_getroot(struct fs* fs)
     struct vnode* vn;
     int result;
 
-    vn = kmalloc(sizeof(struct vnode));
+    vn = kmem_cache_alloc(vnode_cache);
     result = VOP_INIT(vn, &fat_dirops, fs, NULL);
     if (result) {
         log(LOG_FAIL, "fat: getroot: Cannot load root vnode\n");
@@ -543,7 +562,7 @@ struct vnode* fat_getroot_file(struct fs* fs)
     struct vnode* vn;
     int result;
 
-    vn = kmalloc(sizeof(struct vnode));
+    vn = kmem_cache_alloc(vnode_cache);
     result = VOP_INIT(vn, &fat_fileops, fs, NULL);
     if (result) {
         log(LOG_FAIL, "fat: getroot_file: Cannot load root vnode\n");
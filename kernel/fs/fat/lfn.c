@@ -0,0 +1,229 @@
+#include "lfn.h"
+
+/* byte offsets of the 13 UCS-2 characters in a long name entry */
+static const uint8_t lfn_char_offset[LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static uint8_t lfn_upper(uint8_t c)
+{
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 'A';
+
+    return c;
+}
+
+// Characters allowed in a short name besides letters and digits.
+static uint32_t lfn_short_char(uint8_t c)
+{
+    const char* special = "!#$%&'()-@^_`{}~";
+
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+        return 1;
+
+    for (; *special != 0; special++)
+        if (c == *special)
+            return 1;
+
+    return 0;
+}
+
+void lfn_reset(struct lfn_state* s)
+{
+    s->valid = 0;
+    s->expect = 0;
+    s->loc.num = 0;
+}
+
+// Add a long name entry, entries come in descending sequence number.
+// Only ASCII is kept, other characters are replaced by '_'.
+void lfn_collect(struct lfn_state* s, const uint8_t* entry, uint32_t sector, uint32_t offset)
+{
+    uint32_t seq = entry[0] & 0x1f;
+    uint32_t i;
+    uint16_t c;
+
+    if (seq == 0 || seq > LFN_ENTRY_MAX)
+        goto lfn_collect_bad;
+
+    // Entry holding the end of name comes first and starts it.
+    if (entry[0] & LFN_LAST) {
+        s->valid = 1;
+        s->checksum = entry[13];
+        s->loc.sector = sector;
+        s->loc.offset = offset;
+        s->loc.num = seq;
+        s->name[seq * LFN_CHARS] = 0;
+    } else if (!s->valid || seq != s->expect || entry[13] != s->checksum)
+        goto lfn_collect_bad;
+
+    for (i = 0; i < LFN_CHARS; i++) {
+        c = entry[lfn_char_offset[i]] | (entry[lfn_char_offset[i] + 1] << 8);
+        // Both terminator 0x0000 and padding 0xFFFF end the name.
+        if (c == 0xFFFF)
+            c = 0;
+        else if (c >= 0x80)
+            c = '_';
+        s->name[(seq - 1) * LFN_CHARS + i] = (uint8_t)c;
+    }
+
+    s->expect = seq - 1;
+    return;
+
+lfn_collect_bad:
+    lfn_reset(s);
+}
+
+// Called on the short entry following long name entries. Returns length of
+// its long name, left in s->name, or 0 if it has none.
+uint32_t lfn_finish(struct lfn_state* s, const uint8_t* entry)
+{
+    uint32_t len = 0;
+
+    if (s->valid && s->expect == 0 && s->checksum == lfn_checksum(entry)) {
+        while (len < s->loc.num * LFN_CHARS && s->name[len] != 0)
+            len++;
+
+        if (len > LFN_NAME_MAX)
+            len = 0;
+        s->name[len] = 0;
+    }
+
+    if (len == 0)
+        s->loc.num = 0;
+    s->valid = 0;
+    return len;
+}
+
+// Checksum of short name, stored in each of its long name entries.
+uint8_t lfn_checksum(const uint8_t* name11)
+{
+    uint8_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < 11; i++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + name11[i];
+
+    return sum;
+}
+
+// Whether a path component cannot be stored as a short name. Letter case
+// is ignored, short names are compared without case anyway.
+uint32_t lfn_needed(const uint8_t* name, uint32_t len)
+{
+    uint32_t dot = 0xffffffff;
+    uint32_t i;
+
+    // ".", ".." and the like are special short names.
+    for (i = 0; i < len && name[i] == '.'; i++)
+        ;
+    if (i == len)
+        return 0;
+
+    if (len > 12)
+        return 1;
+
+    for (i = 0; i < len; i++) {
+        if (name[i] == '.') {
+            if (dot != 0xffffffff || i == 0)
+                return 1;
+            dot = i;
+        } else if (!lfn_short_char(name[i]))
+            return 1;
+    }
+
+    if (dot == 0xffffffff)
+        return len > 8;
+
+    return dot > 8 || len - dot - 1 > 3;
+}
+
+// Make short alias BASE~N.EXT of a long name.
+void lfn_alias(const uint8_t* name, uint32_t len, uint32_t n, uint8_t* name11)
+{
+    uint8_t tail[8];
+    uint32_t tail_len = 0;
+    uint32_t dot;
+    uint32_t i, k;
+    uint8_t c;
+
+    // Extension comes after the last dot.
+    for (dot = len; dot > 0 && name[dot - 1] != '.'; dot--)
+        ;
+    dot = dot ? dot - 1 : len;
+
+    for (i = 0; i < 11; i++)
+        name11[i] = 0x20;
+    name11[11] = 0;
+
+    k = 0;
+    for (i = 0; i < dot && k < 8; i++) {
+        c = lfn_upper(name[i]);
+        if (c == ' ' || c == '.')
+            continue;
+        name11[k++] = lfn_short_char(c) ? c : '_';
+    }
+    if (k == 0)
+        name11[k++] = '_';
+
+    // Numeric tail replaces end of base if needed.
+    do {
+        tail[tail_len++] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0 && tail_len < 6);
+    tail[tail_len++] = '~';
+
+    if (k > 8 - tail_len)
+        k = 8 - tail_len;
+    while (tail_len > 0)
+        name11[k++] = tail[--tail_len];
+    for (; k < 8; k++)
+        name11[k] = 0x20;
+
+    k = 8;
+    for (i = dot + 1; i < len && k < 11; i++) {
+        c = lfn_upper(name[i]);
+        if (c == ' ' || c == '.')
+            continue;
+        name11[k++] = lfn_short_char(c) ? c : '_';
+    }
+}
+
+// Fill long name entry seq (1 based) of num entries.
+void lfn_fill_entry(uint8_t* entry, const uint8_t* name, uint32_t len, uint32_t seq, uint32_t num, uint8_t checksum)
+{
+    uint32_t pos;
+    uint32_t i;
+    uint16_t c;
+
+    entry[0] = seq | (seq == num ? LFN_LAST : 0);
+    entry[11] = LFN_ATTR;
+    entry[12] = 0;
+    entry[13] = checksum;
+    entry[26] = 0;
+    entry[27] = 0;
+
+    for (i = 0; i < LFN_CHARS; i++) {
+        pos = (seq - 1) * LFN_CHARS + i;
+        // Name ends with 0x0000, rest of last entry is padded with 0xFFFF.
+        if (pos < len)
+            c = name[pos];
+        else if (pos == len)
+            c = 0;
+        else
+            c = 0xFFFF;
+
+        entry[lfn_char_offset[i]] = c & 0xff;
+        entry[lfn_char_offset[i] + 1] = c >> 8;
+    }
+}
+
+// Compare long names without case, 0 if same.
+uint32_t lfn_cmp(const uint8_t* f1, const uint8_t* f2, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        if (lfn_upper(f1[i]) != lfn_upper(f2[i]))
+            return 1;
+
+    return 0;
+}
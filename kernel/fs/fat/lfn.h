@@ -0,0 +1,35 @@
+#ifndef _FAT_LFN_H
+#define _FAT_LFN_H
+
+#include <xsu/fs/fat.h>
+#include <xsu/types.h>
+
+/* VFAT long names, up to 20 entries of 13 characters each */
+#define LFN_NAME_MAX 255
+#define LFN_CHARS 13
+#define LFN_ENTRY_MAX 20
+#define LFN_ATTR 0x0F
+#define LFN_LAST 0x40
+
+/* long name entries collected while walking a directory */
+struct lfn_state {
+    uint8_t name[LFN_ENTRY_MAX * LFN_CHARS + 1];
+    /* sequence number of next entry, 0 when a name is complete */
+    uint32_t expect;
+    /* 1 while entries are being collected or a complete name waits */
+    uint32_t valid;
+    uint8_t checksum;
+    /* where the first long name entry is */
+    struct lfn_loc loc;
+};
+
+void lfn_reset(struct lfn_state* s);
+void lfn_collect(struct lfn_state* s, const uint8_t* entry, uint32_t sector, uint32_t offset);
+uint32_t lfn_finish(struct lfn_state* s, const uint8_t* entry);
+uint8_t lfn_checksum(const uint8_t* name11);
+uint32_t lfn_needed(const uint8_t* name, uint32_t len);
+void lfn_alias(const uint8_t* name, uint32_t len, uint32_t n, uint8_t* name11);
+void lfn_fill_entry(uint8_t* entry, const uint8_t* name, uint32_t len, uint32_t seq, uint32_t num, uint8_t checksum);
+uint32_t lfn_cmp(const uint8_t* f1, const uint8_t* f2, uint32_t len);
+
+#endif
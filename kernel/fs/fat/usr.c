@@ -1,4 +1,6 @@
+#include "dirindex.h"
 #include "fat.h"
+#include "lfn.h"
 #include "utils.h"
 #include <driver/vga.h>
 #include <xsu/log.h>
@@ -21,6 +23,8 @@ uint32_t fs_rm(uint8_t* filename)
 
     // Release all allocated block.
     clus = get_start_cluster(&mk_dir);
+    if (mk_dir.entry.data[11] & 0x10)
+        fs_dir_index_drop(clus);
 
     while (clus != 0 && clus <= fat_info.total_data_clusters + 1) {
         if (get_fat_entry_value(clus, &next_clus) == 1)
@@ -32,16 +36,72 @@ uint32_t fs_rm(uint8_t* filename)
         clus = next_clus;
     }
 
+    // Long name goes with the entry.
+    if (fs_del_lfn(&mk_dir) == 1)
+        goto fs_rm_err;
+
     if (fs_close(&mk_dir) == 1)
         goto fs_rm_err;
 
+    fs_dir_index_remove(mk_dir.dir_clus, mk_dir.dir_entry_sector, mk_dir.dir_entry_pos);
+
     return 0;
 fs_rm_err:
     return 1;
 }
 
+// Normalize an absolute path into out (256 bytes): no empty or "."
+// components, ".." removes the previous one, no trailing slash.
+static void fs_normalize_path(const uint8_t* path, uint8_t* out)
+{
+    uint32_t len = 0;
+    uint32_t n;
+
+    while (*path != 0) {
+        while (*path == '/')
+            path++;
+        for (n = 0; path[n] != 0 && path[n] != '/'; n++)
+            ;
+
+        if (n == 0 || (n == 1 && path[0] == '.')) {
+            // Nothing to add.
+        } else if (n == 2 && path[0] == '.' && path[1] == '.') {
+            while (len > 0 && out[--len] != '/')
+                ;
+        } else if (len + 1 + n < 256) {
+            out[len++] = '/';
+            while (n-- > 0)
+                out[len++] = *path++;
+            continue;
+        }
+
+        path += n;
+    }
+
+    out[len] = 0;
+}
+
+// Whether normalized dest is dir itself or below it, FAT names ignore case.
+static uint32_t fs_path_within(const uint8_t* dir, const uint8_t* dest)
+{
+    uint8_t d[256], p[256];
+    uint32_t len;
+
+    fs_normalize_path(dir, d);
+    fs_normalize_path(dest, p);
+
+    for (len = 0; d[len] != 0; len++)
+        if (p[len] == 0)
+            return 0;
+
+    return lfn_cmp(d, p, len) == 0 && (p[len] == 0 || p[len] == '/');
+}
+
+// Rename by relinking: new entry takes over the clusters of the old one,
+// so no file data is read or written.
 uint32_t fs_mv(uint8_t* src, uint8_t* dest)
 {
+    uint32_t i;
     FILE oldfile, newfile;
 
     // Open src.
@@ -49,25 +109,18 @@ uint32_t fs_mv(uint8_t* src, uint8_t* dest)
         goto fs_mv_err;
     }
 
-    // Read src.
-    uint32_t file_size = get_entry_filesize(oldfile.entry.data);
-    uint8_t* buf = (uint8_t*)kmalloc(file_size + 1);
-    fs_read(&oldfile, buf, file_size);
-    buf[file_size] = 0;
+    // A directory cannot be moved into itself.
+    if ((oldfile.entry.data[11] & 0x10) && fs_path_within(src, dest)) {
+        goto fs_mv_err;
+    }
 
 #ifdef FS_DEBUG
     kernel_printf("fs_mv:\n");
-    kernel_printf("file size: %d\n", file_size);
-    kernel_printf("%s\n", buf);
+    kernel_printf("file size: %d\n", get_entry_filesize(oldfile.entry.data));
 #endif
 
-    // Close src.
-    if (fs_close(&oldfile) == 1) {
-        goto fs_mv_err;
-    }
-
     // Create dst.
-    if (fs_create(dest) == 1) {
+    if (fs_create_with_attr(dest, oldfile.entry.data[11]) == 1) {
         goto fs_mv_err;
     }
 
@@ -76,22 +129,31 @@ uint32_t fs_mv(uint8_t* src, uint8_t* dest)
         goto fs_mv_err;
     }
 
-    // Write dst.
-    if (fs_write(&newfile, buf, file_size) == 1) {
-        goto fs_mv_err;
-    }
+    // Copy everything but the name, including start cluster and size.
+    for (i = 11; i < 32; i++)
+        newfile.entry.data[i] = oldfile.entry.data[i];
 
     // Close dst.
     if (fs_close(&newfile) == 1) {
         goto fs_mv_err;
     }
 
-    // Delete src.
-    if (fs_rm(src) == 1) {
+    // A moved directory's ".." points to its new parent.
+    if ((oldfile.entry.data[11] & 0x10) && fs_set_dotdot(&newfile) == 1) {
         goto fs_mv_err;
     }
 
-    kfree(buf);
+    // Delete src entry only, its clusters belong to dst now.
+    oldfile.entry.data[0] = 0xE5;
+    if (fs_del_lfn(&oldfile) == 1) {
+        goto fs_mv_err;
+    }
+    if (fs_close(&oldfile) == 1) {
+        goto fs_mv_err;
+    }
+
+    fs_dir_index_remove(oldfile.dir_clus, oldfile.dir_entry_sector, oldfile.dir_entry_pos);
+
     return 0;
 fs_mv_err:
     return 1;
@@ -106,23 +168,11 @@ uint32_t fs_cp(unsigned char* src, unsigned char* dest)
         goto fs_cp_err;
     }
 
-    // Read src.
-    uint32_t file_size = get_entry_filesize(oldfile.entry.data);
-    uint8_t* buf = (uint8_t*)kmalloc(file_size + 1);
-    fs_read(&oldfile, buf, file_size);
-    buf[file_size] = 0;
-
 #ifdef FS_DEBUG
     kernel_printf("fs_cp:\n");
-    kernel_printf("file size: %d\n", file_size);
-    kernel_printf("%s\n", buf);
+    kernel_printf("file size: %d\n", get_entry_filesize(oldfile.entry.data));
 #endif
 
-    // Close src.
-    if (fs_close(&oldfile) == 1) {
-        goto fs_cp_err;
-    }
-
     // Create dst.
     if (fs_create(dest) == 1) {
         goto fs_cp_err;
@@ -133,8 +183,8 @@ uint32_t fs_cp(unsigned char* src, unsigned char* dest)
         goto fs_cp_err;
     }
 
-    // Write dst.
-    if (fs_write(&newfile, buf, file_size) == 1) {
+    // Copy src to dst cluster by cluster.
+    if (fs_copy(&newfile, &oldfile) == 1) {
         goto fs_cp_err;
     }
 
@@ -143,7 +193,11 @@ uint32_t fs_cp(unsigned char* src, unsigned char* dest)
         goto fs_cp_err;
     }
 
-    kfree(buf);
+    // Close src.
+    if (fs_close(&oldfile) == 1) {
+        goto fs_cp_err;
+    }
+
     return 0;
 fs_cp_err:
     return 1;
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "bitmap.h"
 #include "fat.h"
 #include <driver/sd.h>
 
@@ -13,6 +14,17 @@ uint32_t write_block(uint8_t* buf, uint32_t addr, uint32_t count)
     return sd_write_block(buf, addr, count);
 }
 
+// Start a read, req is in use until wait_block returns.
+uint32_t read_block_async(struct sd_request* req, uint8_t* buf, uint32_t addr, uint32_t count)
+{
+    return sd_read_async(req, buf, addr, count);
+}
+
+uint32_t wait_block(struct sd_request* req)
+{
+    return sd_wait(req);
+}
+
 // char to uint16_t/uint32_t.
 // Little endian.
 uint16_t get_uint16_t(uint8_t* ch)
@@ -100,12 +112,15 @@ uint32_t fs_modify_fat(uint32_t clus, uint32_t ClusEntryVal)
     if (index == 0xffffffff)
         goto fs_modify_fat_err;
 
-    fat_buf[index].state = 3;
-
     ClusEntryVal &= 0x0FFFFFFF;
     fat32_val = (get_uint32_t(fat_buf[index].buf + ThisFATEntOffset) & 0xF0000000) | ClusEntryVal;
     set_uint32_t(fat_buf[index].buf + ThisFATEntOffset, fat32_val);
 
+    // Mark dirty after modifying, flusher may clean it at any time.
+    fat_buf[index].state = 3;
+
+    fs_bitmap_set(clus, ClusEntryVal);
+
     return 0;
 fs_modify_fat_err:
     return 1;
@@ -115,7 +130,7 @@ fs_modify_fat_err:
 void cluster_to_fat_entry(uint32_t clus, uint32_t* ThisFATSecNum, uint32_t* ThisFATEntOffset)
 {
     uint32_t FATOffset = clus << 2;
-    *ThisFATSecNum = fat_info.BPB.attr.reserved_sectors + (FATOffset >> 9) + fat_info.base_addr;
+    *ThisFATSecNum = fat_info.BPB.attr.reserved_sectors + fat_info.active_fat * fat_info.sectors_per_fat + (FATOffset >> 9) + fat_info.base_addr;
     *ThisFATEntOffset = FATOffset & 511;
 }
 
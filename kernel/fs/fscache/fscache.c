@@ -1,8 +1,27 @@
 #include "fscache.h"
+#include <driver/sd.h>
+#include <intr.h>
 #include <xsu/fs/fat.h>
+#include <xsu/slab.h>
+#include <xsu/utils.h>
 
 extern struct fs_info fat_info;
 
+/* Cluster cache shared by all open files, looked up by hash of sector */
+BUF_4K fscache_4k[FSCACHE_4K_NUM];
+static unsigned long fscache_4k_hash_head[FSCACHE_4K_HASH_NUM];
+static uint32_t fscache_4k_clock_head = 0;
+static uint32_t fscache_4k_shift = 0;
+static uint32_t fscache_4k_size = 0;
+
+/* Flusher state: pass counter and staging buffer for merged writes */
+static uint32_t fscache_4k_epoch = 0;
+static unsigned char* fscache_flush_buf = 0;
+static uint32_t fscache_flush_num = 1;
+
+/* Read-ahead requests, one per buffer, in use while its in-flight bit is set */
+static struct sd_request fscache_4k_req[FSCACHE_4K_NUM];
+
 uint32_t fs_victim_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size)
 {
     uint32_t i;
@@ -12,8 +31,8 @@ uint32_t fs_victim_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size)
     for (i = 0; i < size; i++) {
         // If reference bit is zero.
         if (((buf[*clock_head].state) & 0x01) == 0) {
-            // If dirty bit is also zero, it is the victim.
-            if (((buf[*clock_head].state) & 0x02) == 0) {
+            // If dirty, writeback and in-flight bits are also zero, it is the victim.
+            if (((buf[*clock_head].state) & 0x0e) == 0) {
                 index = *clock_head;
                 goto fs_victim_4k_ok;
             }
@@ -28,8 +47,8 @@ uint32_t fs_victim_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size)
 
     /* sweep 2 */
     for (i = 0; i < size; i++) {
-        // Since reference bit has cleaned in sweep 1, only check dirty bit.
-        if (((buf[*clock_head].state) & 0x02) == 0) {
+        // Reference bits were cleaned in sweep 1, only check busy bits.
+        if (((buf[*clock_head].state) & 0x0e) == 0) {
             index = *clock_head;
             goto fs_victim_4k_ok;
         }
@@ -49,10 +68,11 @@ fs_victim_4k_ok:
     return index;
 }
 
-// Write current 4k buffer.
+// Write current 4k buffer. One still being written by flusher is written
+// again, so it is on sd before the buffer is reused.
 uint32_t fs_write_4k(BUF_4K* f)
 {
-    if ((f->cur != 0xffffffff) && (((f->state) & 0x02) != 0)) {
+    if ((f->cur != 0xffffffff) && (((f->state) & 0x06) != 0)) {
         if (write_block(f->buf, f->cur, fat_info.BPB.attr.sectors_per_cluster) == 1)
             goto fs_write_4k_err;
 
@@ -65,58 +85,400 @@ fs_write_4k_err:
     return 1;
 }
 
-// Read 4k cluster.
-uint32_t fs_read_4k(BUF_4K* f, uint32_t FirstSectorOfCluster, uint32_t* clock_head, uint32_t size)
+// Hash bucket of a cluster, consecutive clusters go to different buckets.
+static uint32_t fscache_4k_hash(uint32_t sec)
+{
+    return (sec >> fscache_4k_shift) & (FSCACHE_4K_HASH_NUM - 1);
+}
+
+// Find a cluster in cache, 0xffffffff if missed.
+static uint32_t fscache_4k_lookup(uint32_t sec)
 {
     uint32_t index;
-    uint32_t FirstSecWithOfs = FirstSectorOfCluster + fat_info.base_addr;
-    // Try to find in buffer.
-    for (index = 0; (index < size) && (f[index].cur != FirstSecWithOfs); index++) {
+
+    for (index = fscache_4k_hash_head[fscache_4k_hash(sec)]; index != 0xffffffff; index = fscache_4k[index].hash_next)
+        if (fscache_4k[index].cur == sec)
+            break;
+
+    return index;
+}
+
+// Remove a buffer from its hash bucket.
+static void fscache_4k_unhash(uint32_t index)
+{
+    unsigned long* link;
+
+    if (fscache_4k[index].cur == 0xffffffff)
+        return;
+
+    for (link = fscache_4k_hash_head + fscache_4k_hash(fscache_4k[index].cur); *link != 0xffffffff; link = &(fscache_4k[*link].hash_next))
+        if (*link == index) {
+            *link = fscache_4k[index].hash_next;
+            break;
+        }
+
+    fscache_4k[index].hash_next = 0xffffffff;
+}
+
+// Wait for a read-ahead into a buffer to land. A failed one leaves the
+// buffer empty, return 1 then.
+static uint32_t fscache_4k_wait(uint32_t index)
+{
+    if ((fscache_4k[index].state & 0x08) == 0)
+        return 0;
+
+    fscache_4k[index].state &= ~0x08;
+    if (wait_block(fscache_4k_req + index) == 1) {
+        fscache_4k_unhash(index);
+        fscache_4k[index].cur = 0xffffffff;
+        fscache_4k[index].state = 0;
+        return 1;
     }
 
-    // If not in buffer, find victim & replace, otherwise set reference bit.
-    if (index == size) {
-        index = fs_victim_4k(f, clock_head, size);
+    return 0;
+}
+
+// Find a cluster in cache whose data can be used, 0xffffffff if missed.
+static uint32_t fscache_4k_get(uint32_t sec)
+{
+    uint32_t index = fscache_4k_lookup(sec);
+
+    if (index != 0xffffffff && fscache_4k_wait(index) == 1)
+        return 0xffffffff;
+
+    return index;
+}
+
+// Put a buffer into the hash bucket of its current cluster.
+static void fscache_4k_hash_insert(uint32_t index)
+{
+    uint32_t bucket = fscache_4k_hash(fscache_4k[index].cur);
 
-        if (fs_write_4k(f + index) == 1)
+    fscache_4k[index].hash_next = fscache_4k_hash_head[bucket];
+    fscache_4k_hash_head[bucket] = index;
+}
+
+// Pick a victim buffer, write it back and detach it from the old cluster.
+static uint32_t fscache_4k_replace(uint32_t sec)
+{
+    uint32_t index;
+
+    index = fs_victim_4k(fscache_4k, &fscache_4k_clock_head, FSCACHE_4K_NUM);
+
+    // Only taken when every buffer is busy, the read must not land later.
+    fscache_4k_wait(index);
+
+    if (fs_write_4k(fscache_4k + index) == 1)
+        goto fscache_4k_replace_err;
+
+    fscache_4k_unhash(index);
+    fscache_4k[index].cur = sec;
+    fscache_4k_hash_insert(index);
+
+    return index;
+fscache_4k_replace_err:
+    return 0xffffffff;
+}
+
+// Init cluster cache, buffers are kept across remounts.
+uint32_t init_fscache_4k()
+{
+    uint32_t i;
+    uint32_t cluster_size = fat_info.BPB.attr.sectors_per_cluster << 9;
+
+    // Cluster size may only change when a different card is mounted.
+    if (fscache_4k_size != cluster_size) {
+        for (i = 0; i < FSCACHE_4K_NUM; i++) {
+            if (fscache_4k[i].buf)
+                kfree(fscache_4k[i].buf);
+
+            fscache_4k[i].buf = (unsigned char*)kmalloc(cluster_size);
+            if (fscache_4k[i].buf == 0)
+                goto init_fscache_4k_err;
+        }
+        fscache_4k_size = cluster_size;
+
+        // Without staging buffer, flusher writes clusters one by one.
+        if (fscache_flush_buf == 0)
+            fscache_flush_buf = (unsigned char*)kmalloc(FS_FLUSH_BUF_SIZE);
+        fscache_flush_num = 1;
+        if (fscache_flush_buf && cluster_size < FS_FLUSH_BUF_SIZE)
+            fscache_flush_num = FS_FLUSH_BUF_SIZE / cluster_size;
+    }
+
+    for (i = 0; i < FSCACHE_4K_NUM; i++) {
+        fscache_4k_wait(i);
+        fscache_4k[i].cur = 0xffffffff;
+        fscache_4k[i].state = 0;
+        fscache_4k[i].hash_next = 0xffffffff;
+        fscache_4k[i].dirty_epoch = 0;
+    }
+
+    for (i = 0; i < FSCACHE_4K_HASH_NUM; i++)
+        fscache_4k_hash_head[i] = 0xffffffff;
+
+    fscache_4k_clock_head = 0;
+    for (fscache_4k_shift = 0; (1 << fscache_4k_shift) < fat_info.BPB.attr.sectors_per_cluster; fscache_4k_shift++)
+        ;
+
+    return 0;
+
+init_fscache_4k_err:
+    fscache_4k_size = 0;
+    return 1;
+}
+
+// Index of a cached cluster, 0xffffffff if it is not in cache.
+uint32_t fs_lookup_4k(uint32_t FirstSectorOfCluster)
+{
+    return fscache_4k_get(FirstSectorOfCluster + fat_info.base_addr);
+}
+
+// Read 4k cluster, return index in cluster cache.
+uint32_t fs_read_4k(uint32_t FirstSectorOfCluster)
+{
+    uint32_t index;
+    uint32_t FirstSecWithOfs = FirstSectorOfCluster + fat_info.base_addr;
+
+    index = fscache_4k_get(FirstSecWithOfs);
+
+    // If not in buffer, find victim & replace, otherwise set reference bit.
+    if (index == 0xffffffff) {
+        index = fscache_4k_replace(FirstSecWithOfs);
+        if (index == 0xffffffff)
             goto fs_read_4k_err;
 
-        if (read_block(f[index].buf, FirstSecWithOfs, fat_info.BPB.attr.sectors_per_cluster) == 1)
+        if (read_block(fscache_4k[index].buf, FirstSecWithOfs, fat_info.BPB.attr.sectors_per_cluster) == 1) {
+            fscache_4k_unhash(index);
+            fscache_4k[index].cur = 0xffffffff;
             goto fs_read_4k_err;
+        }
 
-        f[index].cur = FirstSecWithOfs;
-        f[index].state = 1;
+        fscache_4k[index].state = 1;
     } else
-        f[index].state |= 0x01;
+        fscache_4k[index].state |= 0x01;
 
     return index;
 fs_read_4k_err:
     return 0xffffffff;
 }
 
-// Clear a buffer block, used to avoid reading a new erased block from sd.
-uint32_t fs_clr_4k(BUF_4K* buf, uint32_t* clock_head, uint32_t size, uint32_t cur)
+// Start reading a cluster into cache without waiting for it. The buffer is
+// marked in flight, whoever looks it up next waits for the data.
+uint32_t fs_prefetch_4k(uint32_t FirstSectorOfCluster)
 {
     uint32_t index;
-    uint32_t i;
-
-    index = fs_victim_4k(buf, clock_head, size);
+    uint32_t FirstSecWithOfs = FirstSectorOfCluster + fat_info.base_addr;
 
-    if (fs_write_4k(buf + index) == 1)
-        goto fs_clr_4k_err;
+    if (fscache_4k_lookup(FirstSecWithOfs) != 0xffffffff)
+        return 0;
 
-    for (i = 0; i < (fat_info.BPB.attr.sectors_per_cluster << 9); i++)
-        buf[index].buf[i] = 0;
+    index = fscache_4k_replace(FirstSecWithOfs);
+    if (index == 0xffffffff)
+        goto fs_prefetch_4k_err;
 
-    buf[index].cur = cur;
-    buf[index].state = 0;
+    fscache_4k[index].state = 0x09;
+    if (read_block_async(fscache_4k_req + index, fscache_4k[index].buf, FirstSecWithOfs, fat_info.BPB.attr.sectors_per_cluster) == 1) {
+        fscache_4k_wait(index);
+        goto fs_prefetch_4k_err;
+    }
 
     return 0;
+fs_prefetch_4k_err:
+    return 1;
+}
 
+// Claim a buffer for a newly allocated cluster without reading it from sd,
+// return its index. Only bytes outside [start, end), which the caller does
+// not fill, are cleared.
+uint32_t fs_clr_4k(uint32_t FirstSectorOfCluster, uint32_t start, uint32_t end)
+{
+    uint32_t index;
+    uint32_t FirstSecWithOfs = FirstSectorOfCluster + fat_info.base_addr;
+
+    // A freed cluster may still be cached, reuse its buffer.
+    index = fscache_4k_get(FirstSecWithOfs);
+    if (index == 0xffffffff) {
+        index = fscache_4k_replace(FirstSecWithOfs);
+        if (index == 0xffffffff)
+            goto fs_clr_4k_err;
+    }
+
+    kernel_memset(fscache_4k[index].buf, 0, start);
+    kernel_memset(fscache_4k[index].buf + end, 0, fscache_4k_size - end);
+
+    // Keep writeback bit, flusher may still be writing old data.
+    fscache_4k[index].state = (fscache_4k[index].state & 0x04) | 0x01;
+
+    return index;
 fs_clr_4k_err:
+    return 0xffffffff;
+}
+
+// Copy a cluster to another through cluster cache, return index of destination.
+// Destination buffer is claimed first, so the source either is copied from
+// its cached buffer or is read from sd straight into destination buffer.
+// Destination is left dirty for flusher.
+uint32_t fs_copy_4k(uint32_t SrcSectorOfCluster, uint32_t DstSectorOfCluster)
+{
+    uint32_t index;
+    uint32_t src;
+    uint32_t SrcSecWithOfs = SrcSectorOfCluster + fat_info.base_addr;
+    uint32_t DstSecWithOfs = DstSectorOfCluster + fat_info.base_addr;
+
+    index = fscache_4k_get(DstSecWithOfs);
+    if (index == 0xffffffff) {
+        index = fscache_4k_replace(DstSecWithOfs);
+        if (index == 0xffffffff)
+            goto fs_copy_4k_err;
+    }
+
+    src = fscache_4k_get(SrcSecWithOfs);
+    if (src != 0xffffffff) {
+        kernel_memcpy(fscache_4k[index].buf, fscache_4k[src].buf, fscache_4k_size);
+        fscache_4k[src].state |= 0x01;
+    } else if (read_block(fscache_4k[index].buf, SrcSecWithOfs, fat_info.BPB.attr.sectors_per_cluster) == 1) {
+        fscache_4k_unhash(index);
+        fscache_4k[index].cur = 0xffffffff;
+        fscache_4k[index].state = 0;
+        goto fs_copy_4k_err;
+    }
+
+    fs_dirty_4k(index);
+
+    return index;
+fs_copy_4k_err:
+    return 0xffffffff;
+}
+
+// Write all dirty clusters to sd.
+uint32_t fs_fflush_4k()
+{
+    uint32_t i;
+
+    for (i = 0; i < FSCACHE_4K_NUM; i++)
+        if (fs_write_4k(fscache_4k + i) == 1)
+            goto fs_fflush_4k_err;
+
+    return 0;
+
+fs_fflush_4k_err:
     return 1;
 }
 
+// Mark a cluster dirty, called after its data has been modified.
+void fs_dirty_4k(uint32_t index)
+{
+    if ((fscache_4k[index].state & 0x02) == 0)
+        fscache_4k[index].dirty_epoch = fscache_4k_epoch;
+
+    fscache_4k[index].state |= 0x03;
+}
+
+// Flusher pass: write back old dirty clusters, or all of them if all is set
+// or too many are dirty. Clusters are sorted by sector and adjacent ones merged.
+// Interrupts are only off while buffers are picked, and while each one is
+// copied to the staging buffer, the sd writes run with them on. Copied buffers are clean with the
+// writeback bit set until their write is done, so they are not reused and
+// read back from sd before that. Writers mark dirty after copying data in.
+uint32_t fs_flush_4k(uint32_t all)
+{
+    uint32_t dirty[FSCACHE_4K_NUM];
+    uint32_t sec[FSCACHE_4K_NUM];
+    uint32_t dirty_num = 0;
+    uint32_t num = 0;
+    uint32_t i, j, k, tmp;
+    uint32_t old_ie;
+    uint32_t ret = 0;
+
+    old_ie = disable_interrupts();
+
+    for (i = 0; i < FSCACHE_4K_NUM; i++)
+        if (fscache_4k[i].cur != 0xffffffff && (fscache_4k[i].state & 0x02) != 0)
+            dirty_num++;
+
+    if (dirty_num * 100 >= FS_DIRTY_RATIO * FSCACHE_4K_NUM)
+        all = 1;
+
+    for (i = 0; i < FSCACHE_4K_NUM; i++) {
+        if (fscache_4k[i].cur == 0xffffffff || (fscache_4k[i].state & 0x02) == 0)
+            continue;
+        if (all || fscache_4k_epoch - fscache_4k[i].dirty_epoch >= FS_DIRTY_AGE / FS_FLUSH_INTERVAL)
+            dirty[num++] = i;
+    }
+
+    // Sort by sector, at most FSCACHE_4K_NUM entries.
+    for (i = 1; i < num; i++) {
+        tmp = dirty[i];
+        for (j = i; j > 0 && fscache_4k[dirty[j - 1]].cur > fscache_4k[tmp].cur; j--)
+            dirty[j] = dirty[j - 1];
+        dirty[j] = tmp;
+    }
+    for (i = 0; i < num; i++)
+        sec[i] = fscache_4k[dirty[i]].cur;
+
+    fscache_4k_epoch++;
+
+    // Without staging buffer, write buffers in place with interrupts off.
+    if (fscache_flush_buf == 0) {
+        for (i = 0; i < num; i++)
+            if (fs_write_4k(fscache_4k + dirty[i]) == 1)
+                ret = 1;
+        if (old_ie)
+            enable_interrupts();
+        return ret;
+    }
+
+    if (old_ie)
+        enable_interrupts();
+
+    for (i = 0; i < num; i += j) {
+        // Foreground runs between the copies, so buffers may have been
+        // cleaned or reused since they were picked. Interrupts are only
+        // off while one buffer is checked and copied.
+        for (j = 0; i + j < num && j < fscache_flush_num; j++) {
+            if (j != 0 && sec[i + j] != sec[i + j - 1] + fat_info.BPB.attr.sectors_per_cluster)
+                break;
+
+            tmp = dirty[i + j];
+            old_ie = disable_interrupts();
+            if (fscache_4k[tmp].cur != sec[i + j] || (fscache_4k[tmp].state & 0x02) == 0) {
+                if (old_ie)
+                    enable_interrupts();
+                break;
+            }
+            kernel_memcpy(fscache_flush_buf + j * fscache_4k_size, fscache_4k[tmp].buf, fscache_4k_size);
+            fscache_4k[tmp].state = (fscache_4k[tmp].state & 0x01) | 0x04;
+            if (old_ie)
+                enable_interrupts();
+        }
+
+        // First buffer was not dirty any more, skip it.
+        if (j == 0) {
+            j = 1;
+            continue;
+        }
+
+        tmp = write_block(fscache_flush_buf, sec[i], j * fat_info.BPB.attr.sectors_per_cluster);
+
+        old_ie = disable_interrupts();
+        for (k = i; k < i + j; k++) {
+            if (fscache_4k[dirty[k]].cur != sec[k])
+                continue;
+            fscache_4k[dirty[k]].state &= ~0x04;
+            if (tmp == 1)
+                fs_dirty_4k(dirty[k]);
+        }
+        if (old_ie)
+            enable_interrupts();
+
+        if (tmp == 1)
+            ret = 1;
+    }
+
+    return ret;
+}
+
 // Find victim in 512-byte/4k buffer.
 uint32_t fs_victim_512(BUF_512* buf, uint32_t* clock_head, uint32_t size)
 {
@@ -127,8 +489,8 @@ uint32_t fs_victim_512(BUF_512* buf, uint32_t* clock_head, uint32_t size)
     for (i = 0; i < size; i++) {
         // If reference bit is zero.
         if (((buf[*clock_head].state) & 0x01) == 0) {
-            // If dirty bit is also zero, it is the victim.
-            if (((buf[*clock_head].state) & 0x02) == 0) {
+            // If dirty and writeback bits are also zero, it is the victim.
+            if (((buf[*clock_head].state) & 0x06) == 0) {
                 index = *clock_head;
                 goto fs_victim_512_ok;
             }
@@ -144,7 +506,7 @@ uint32_t fs_victim_512(BUF_512* buf, uint32_t* clock_head, uint32_t size)
     /* sweep 2 */
     for (i = 0; i < size; i++) {
         // Since reference bit has cleaned in sweep 1, only check dirty bit.
-        if (((buf[*clock_head].state) & 0x02) == 0) {
+        if (((buf[*clock_head].state) & 0x06) == 0) {
             index = *clock_head;
             goto fs_victim_512_ok;
         }
@@ -167,7 +529,7 @@ fs_victim_512_ok:
 // Write current 512 buffer.
 uint32_t fs_write_512(BUF_512* f)
 {
-    if ((f->cur != 0xffffffff) && (((f->state) & 0x02) != 0)) {
+    if ((f->cur != 0xffffffff) && (((f->state) & 0x06) != 0)) {
         if (write_block(f->buf, f->cur, 1) == 1)
             goto fs_write_512_err;
 
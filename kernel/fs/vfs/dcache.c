@@ -0,0 +1,196 @@
+#include <xsu/fs/dcache.h>
+#include <xsu/list.h>
+#include <xsu/utils.h>
+
+/*
+ * Path cache entry. Entries live in a fixed pool, on one hash chain
+ * and on the LRU list (most recently used first).
+ */
+struct dentry {
+    char path[DCACHE_PATH_LEN];
+    unsigned int hash;
+    int negative;
+    struct dentry_loc loc;
+    /* 0 if entry is free */
+    int used;
+    struct list_head hash_list;
+    struct list_head lru;
+};
+
+static struct dentry dentries[DCACHE_NUM];
+static struct list_head dcache_hash[DCACHE_HASH_NUM];
+static struct list_head dcache_lru;
+static int dcache_ready = 0;
+
+static char dcache_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static unsigned int dcache_hashpath(const char* path)
+{
+    unsigned int h = 0;
+
+    while (*path) {
+        h = h * 31 + dcache_upper(*path);
+        path++;
+    }
+    return h;
+}
+
+static int dcache_samepath(const char* p1, const char* p2)
+{
+    while (*p1 && dcache_upper(*p1) == dcache_upper(*p2)) {
+        p1++;
+        p2++;
+    }
+    return *p1 == *p2;
+}
+
+static void dcache_init(void)
+{
+    int i;
+
+    for (i = 0; i < DCACHE_HASH_NUM; i++) {
+        INIT_LIST_HEAD(&dcache_hash[i]);
+    }
+    INIT_LIST_HEAD(&dcache_lru);
+
+    // All entries start on LRU list as free, at its tail.
+    for (i = 0; i < DCACHE_NUM; i++) {
+        dentries[i].used = 0;
+        INIT_LIST_HEAD(&dentries[i].hash_list);
+        list_add_tail(&dentries[i].lru, &dcache_lru);
+    }
+    dcache_ready = 1;
+}
+
+static void dcache_free(struct dentry* d)
+{
+    d->used = 0;
+    list_del_init(&d->hash_list);
+    // Free entries are reused first.
+    list_del(&d->lru);
+    list_add_tail(&d->lru, &dcache_lru);
+}
+
+static struct dentry* dcache_find(const char* path, unsigned int hash)
+{
+    struct list_head* pos;
+    struct dentry* d;
+
+    list_for_each(pos, &dcache_hash[hash & (DCACHE_HASH_NUM - 1)])
+    {
+        d = list_entry(pos, struct dentry, hash_list);
+        if (d->hash == hash && dcache_samepath(d->path, path)) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+int dcache_lookup(const char* path, struct dentry_loc* loc)
+{
+    unsigned int hash;
+    struct dentry* d;
+
+    if (!dcache_ready) {
+        dcache_init();
+    }
+
+    hash = dcache_hashpath(path);
+    d = dcache_find(path, hash);
+    if (d == NULL) {
+        return DCACHE_MISS;
+    }
+
+    // Move to LRU head.
+    list_del(&d->lru);
+    list_add(&d->lru, &dcache_lru);
+
+    if (d->negative) {
+        return DCACHE_NEGATIVE;
+    }
+    *loc = d->loc;
+    return DCACHE_HIT;
+}
+
+void dcache_enter(const char* path, const struct dentry_loc* loc)
+{
+    unsigned int hash;
+    struct dentry* d;
+
+    if (!dcache_ready) {
+        dcache_init();
+    }
+
+    if (kernel_strlen(path) >= DCACHE_PATH_LEN) {
+        return;
+    }
+
+    hash = dcache_hashpath(path);
+    d = dcache_find(path, hash);
+    if (d == NULL) {
+        // Reuse least recently used (or free) entry.
+        d = list_entry(dcache_lru.prev, struct dentry, lru);
+        list_del_init(&d->hash_list);
+        kernel_strcpy(d->path, path);
+        d->hash = hash;
+        d->used = 1;
+        list_add(&d->hash_list, &dcache_hash[hash & (DCACHE_HASH_NUM - 1)]);
+    }
+
+    d->negative = (loc == NULL);
+    if (loc) {
+        d->loc = *loc;
+    }
+
+    list_del(&d->lru);
+    list_add(&d->lru, &dcache_lru);
+}
+
+void dcache_drop_negative(void)
+{
+    int i;
+
+    if (!dcache_ready) {
+        return;
+    }
+
+    for (i = 0; i < DCACHE_NUM; i++) {
+        if (dentries[i].used && dentries[i].negative) {
+            dcache_free(&dentries[i]);
+        }
+    }
+}
+
+void dcache_drop_loc(unsigned long sector, unsigned long offset)
+{
+    int i;
+
+    if (!dcache_ready) {
+        return;
+    }
+
+    // Several spellings of a name may point to the same entry.
+    for (i = 0; i < DCACHE_NUM; i++) {
+        if (dentries[i].used && !dentries[i].negative && dentries[i].loc.sector == sector && dentries[i].loc.offset == offset) {
+            dcache_free(&dentries[i]);
+        }
+    }
+}
+
+void dcache_flush(void)
+{
+    int i;
+
+    if (!dcache_ready) {
+        return;
+    }
+
+    for (i = 0; i < DCACHE_NUM; i++) {
+        if (dentries[i].used) {
+            dcache_free(&dentries[i]);
+        }
+    }
+}
@@ -37,6 +37,7 @@
 #include <kern/errno.h>
 #include <xsu/device.h>
 #include <xsu/fs/fcntl.h>
+#include <xsu/fs/vfs.h>
 #include <xsu/fs/vnode.h>
 #include <xsu/log.h>
 #include <xsu/slab.h>
@@ -405,7 +406,7 @@ struct vnode* dev_create_vnode(struct device* dev)
     int result;
     struct vnode* v;
 
-    v = kmalloc(sizeof(struct vnode));
+    v = kmem_cache_alloc(vnode_cache);
     if (v == NULL) {
         return NULL;
     }
@@ -7,6 +7,8 @@
 #include <kern/errno.h>
 #include <xsu/array.h>
 #include <xsu/device.h>
+#include <xsu/fs/dcache.h>
+#include <xsu/fs/fat.h>
 #include <xsu/fs/fs.h>
 #include <xsu/fs/vfs.h>
 #include <xsu/fs/vnode.h>
@@ -55,11 +57,21 @@ struct knowndev {
 
 static struct array* knowndevs;
 
+struct kmem_cache* vnode_cache;
+struct kmem_cache* fat_file_cache;
+struct kmem_cache* fat_dir_cache;
+static struct kmem_cache* knowndev_cache;
+
 /*
  * Setup function. 
  */
 void vfs_bootstrap(void)
 {
+    vnode_cache = kmem_cache_create("vnode", sizeof(struct vnode), 0, NULL);
+    fat_file_cache = kmem_cache_create("fat_file", sizeof(FILE), 0, NULL);
+    fat_dir_cache = kmem_cache_create("fat_dir", sizeof(FS_FAT_DIR), 0, NULL);
+    knowndev_cache = kmem_cache_create("knowndev", sizeof(struct knowndev), 0, NULL);
+
     knowndevs = array_create();
     if (knowndevs == NULL) {
         log(LOG_FAIL, "VFS: Could not create knowndevs array.");
@@ -173,7 +185,7 @@ static int vfs_doadd(const char* dname, int mountable, struct device* dev, struc
         goto nomem;
     }
 
-    kd = kmalloc(sizeof(struct knowndev));
+    kd = kmem_cache_alloc(knowndev_cache);
     if (kd == NULL) {
         goto nomem;
     }
@@ -217,10 +229,10 @@ nomem:
         kfree(rawname);
     }
     if (vnode) {
-        kfree(vnode);
+        kmem_cache_free(vnode_cache, vnode);
     }
     if (kd) {
-        kfree(kd);
+        kmem_cache_free(knowndev_cache, kd);
     }
 
     return ENOMEM;
@@ -392,6 +404,8 @@ int vfs_mount(const char* devname, void* data, int (*mountfunc)(void* data, stru
     assert(fs != NULL, "file system does not exist.");
 
     kd->kd_fs = fs;
+    // Cached paths may be of another card.
+    dcache_flush();
 
     volname = FSOP_GETVOLNAME(fs);
     kernel_printf("vfs: mounted %s: on %s\n", volname ? volname : kd->kd_name, kd->kd_name);
@@ -434,6 +448,7 @@ int vfs_unmount(const char* devname)
 
     // Now drop the filesystem.
     kd->kd_fs = NULL;
+    dcache_flush();
 
     assert(result == 0, "unmount failed");
 
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <driver/vga.h>
 #include <kern/errno.h>
+#include <xsu/fs/dcache.h>
 #include <xsu/fs/fat.h>
 #include <xsu/fs/fcntl.h>
 #include <xsu/fs/vfs.h>
@@ -14,13 +15,72 @@
 
 #define NAME_MAX 255
 
+/* Open a file by fs path, resolving it through path cache. */
+static int vfs_fs_open(FILE* file, char* name)
+{
+    struct dentry_loc loc;
+
+    switch (dcache_lookup(name, &loc)) {
+    case DCACHE_NEGATIVE:
+        return ENOENT;
+    case DCACHE_HIT:
+        if (fs_open_at(file, name, &loc) == 0) {
+            return 0;
+        }
+        // Entry moved or was removed behind our back, resolve again.
+        break;
+    }
+
+    if (fs_open(file, name)) {
+        dcache_enter(name, NULL);
+        return ENOENT;
+    }
+
+    loc.sector = file->dir_entry_sector;
+    loc.offset = file->dir_entry_pos;
+    loc.dir_clus = file->dir_clus;
+    dcache_enter(name, &loc);
+    return 0;
+}
+
+/*
+ * Path cache is kept up to date here, for all changes made through VFS.
+ * Find where the entry of a path is, before it goes away.
+ */
+static int vfs_fs_locate(char* name, struct dentry_loc* loc, int* isdir)
+{
+    FILE file;
+
+    if (vfs_fs_open(&file, name)) {
+        return ENOENT;
+    }
+
+    loc->sector = file.dir_entry_sector;
+    loc->offset = file.dir_entry_pos;
+    loc->dir_clus = file.dir_clus;
+    *isdir = (file.entry.data[11] & 0x10) != 0;
+    return 0;
+}
+
+/* Forget a removed or moved entry in path cache. */
+static void vfs_fs_forget(const struct dentry_loc* loc, int isdir)
+{
+    // Cached paths below a directory are gone as well.
+    if (isdir) {
+        dcache_flush();
+    } else {
+        dcache_drop_loc(loc->sector, loc->offset);
+    }
+}
+
 /* Does most of the work for open(). */
 int vfs_open(char* path, int openflags, mode_t mode, struct vnode** ret)
 {
     int how;
     int result;
     int canwrite;
-    struct vnode* vn = NULL;
+    struct vnode* root = NULL;
+    struct vnode* vn;
 
     how = openflags & O_ACCMODE;
 
@@ -41,20 +101,45 @@ int vfs_open(char* path, int openflags, mode_t mode, struct vnode** ret)
 
     kernel_memcpy(name, path + 3, kernel_strlen(path) - 2);
 
-    result = fs_open(file, name);
+    file = kmem_cache_alloc(fat_file_cache);
+    if (file == NULL) {
+        return ENOMEM;
+    }
+
+    result = vfs_fs_open(file, name);
+    if (result) {
+        kmem_cache_free(fat_file_cache, file);
+        return result;
+    }
+
+    // Every open file gets a vnode of its own, like open directories.
+    result = vfs_getroot("sd", &root, true);
     if (result) {
+        fs_close(file);
+        kmem_cache_free(fat_file_cache, file);
         return result;
     }
 
-    result = vfs_getroot("sd", &vn, true);
+    vn = kmem_cache_alloc(vnode_cache);
+    if (vn == NULL) {
+        VOP_DECREF(root);
+        fs_close(file);
+        kmem_cache_free(fat_file_cache, file);
+        return ENOMEM;
+    }
+
+    result = VOP_INIT(vn, root->vn_ops, root->vn_fs, file);
+    VOP_DECREF(root);
     if (result) {
+        kmem_cache_free(vnode_cache, vn);
+        fs_close(file);
+        kmem_cache_free(fat_file_cache, file);
         return result;
     }
 
-    vn->vn_data = file;
     *ret = vn;
 
-    return result;
+    return 0;
 }
 
 /* Does most of the work for close(). */
@@ -76,7 +161,68 @@ void vfs_close(struct vnode* vn)
 
     FILE* file = vn->vn_data;
     fs_close(file);
-    vn->vn_data = 0;
+    kmem_cache_free(fat_file_cache, file);
+    VOP_CLEANUP(vn);
+    kmem_cache_free(vnode_cache, vn);
+}
+
+/*
+ * Open a directory for VOP_GETDIRENTRY. Each open directory gets a vnode
+ * of its own, the root vnode of the filesystem only lends its operations,
+ * so opening another directory never touches this one.
+ */
+int vfs_opendir(char* path, struct vnode** ret)
+{
+    char name[256];
+    FS_FAT_DIR* dir;
+    struct vnode* root = NULL;
+    struct vnode* vn;
+    int result;
+
+    kernel_memcpy(name, path + 3, kernel_strlen(path) - 2);
+
+    dir = kmem_cache_alloc(fat_dir_cache);
+    if (dir == NULL) {
+        return ENOMEM;
+    }
+
+    if (fs_open_dir(dir, name)) {
+        kmem_cache_free(fat_dir_cache, dir);
+        return ENOTDIR;
+    }
+
+    result = vfs_getroot("sd", &root, false);
+    if (result) {
+        kmem_cache_free(fat_dir_cache, dir);
+        return result;
+    }
+
+    vn = kmem_cache_alloc(vnode_cache);
+    if (vn == NULL) {
+        VOP_DECREF(root);
+        kmem_cache_free(fat_dir_cache, dir);
+        return ENOMEM;
+    }
+
+    result = VOP_INIT(vn, root->vn_ops, root->vn_fs, dir);
+    VOP_DECREF(root);
+    if (result) {
+        kmem_cache_free(vnode_cache, vn);
+        kmem_cache_free(fat_dir_cache, dir);
+        return result;
+    }
+
+    *ret = vn;
+
+    return 0;
+}
+
+/* Close a directory opened with vfs_opendir, its vnode goes with it. */
+void vfs_closedir(struct vnode* vn)
+{
+    kmem_cache_free(fat_dir_cache, vn->vn_data);
+    VOP_CLEANUP(vn);
+    kmem_cache_free(vnode_cache, vn);
 }
 
 /* Does most of the work for remove(). */
@@ -84,6 +230,8 @@ int vfs_remove(char* path)
 {
     struct vnode* dir;
     char name[256];
+    struct dentry_loc loc;
+    int isdir;
     int result;
 
     kernel_memcpy(name, path + 3, kernel_strlen(path) - 2);
@@ -93,7 +241,15 @@ int vfs_remove(char* path)
         return result;
     }
 
+    result = vfs_fs_locate(name, &loc, &isdir);
+    if (result) {
+        return result;
+    }
+
     result = VOP_REMOVE(dir, name);
+    if (result == 0) {
+        vfs_fs_forget(&loc, isdir);
+    }
 
     return result;
 }
@@ -105,6 +261,8 @@ int vfs_rename(char* oldpath, char* newpath)
     char oldname[256];
     struct vnode* newdir;
     char newname[256];
+    struct dentry_loc loc;
+    int isdir;
     int result;
 
     kernel_memcpy(oldname, oldpath + 3, kernel_strlen(oldpath) - 2);
@@ -123,7 +281,17 @@ int vfs_rename(char* oldpath, char* newpath)
         return EXDEV;
     }
 
+    result = vfs_fs_locate(oldname, &loc, &isdir);
+    if (result) {
+        return result;
+    }
+
     result = VOP_RENAME(olddir, oldname, newdir, newname);
+    if (result == 0) {
+        vfs_fs_forget(&loc, isdir);
+        // New path may have been cached as missing.
+        dcache_drop_negative();
+    }
 
     return result;
 }
@@ -140,6 +308,9 @@ int vfs_cp(char* oldpath, char* newpath)
     kernel_memcpy(newname, newpath + 3, kernel_strlen(newpath) - 2);
 
     result = fs_cp(oldname, newname);
+    if (result == 0) {
+        dcache_drop_negative();
+    }
 
     return result;
 }
@@ -153,6 +324,10 @@ int vfs_create(char* path)
     kernel_memcpy(name, path + 3, kernel_strlen(path) - 2);
 
     result = fs_create(name);
+    if (result == 0) {
+        // Path may have been cached as missing.
+        dcache_drop_negative();
+    }
 
     return result;
 }
@@ -166,10 +341,13 @@ int vfs_touch(char* path)
 
     kernel_memcpy(name, path + 3, kernel_strlen(path) - 2);
 
-    result = fs_open(&file, name);
+    result = vfs_fs_open(&file, name);
     if (result) {
         // The file does not exist, create it.
         result = fs_create(name);
+        if (result == 0) {
+            dcache_drop_negative();
+        }
     } else {
         // The file exists, change the modification time.
         char time_buf[10];
@@ -245,6 +423,9 @@ int vfs_mkdir(char* path, mode_t mode)
     }
 
     result = VOP_MKDIR(parent, name, mode);
+    if (result == 0) {
+        dcache_drop_negative();
+    }
 
     return result;
 }
@@ -86,11 +86,15 @@ void vnode_cleanup(struct vnode* vn)
     assert(vn->vn_countlock != NULL, "vnode is locked!");
 
     // lock_release(vn->vn_countlock);
+    lock_destroy(vn->vn_rwlock);
+    lock_destroy(vn->vn_createlock);
     lock_destroy(vn->vn_countlock);
     vn->vn_ops = NULL;
     vn->vn_refcount = 0;
     vn->vn_opencount = 0;
     vn->vn_fs = NULL;
+    vn->vn_rwlock = NULL;
+    vn->vn_createlock = NULL;
     vn->vn_countlock = NULL;
     vn->vn_data = NULL;
 }
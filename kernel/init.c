@@ -1,6 +1,7 @@
 #include "../usr/menu.h"
 #include <arch.h>
 #include <driver/ps2.h>
+#include <driver/sd.h>
 #include <driver/vga.h>
 #include <exc.h>
 #include <intr.h>
@@ -15,6 +16,7 @@
 #include <xsu/log.h>
 #include <xsu/pc.h>
 #include <xsu/slab.h>
+#include <xsu/synch.h>
 #include <xsu/syscall.h>
 #include <xsu/time.h>
 
@@ -70,6 +72,7 @@ void init_kernel()
     init_buddy();
     log(LOG_OK, "Buddy.");
     init_slab();
+    synch_bootstrap();
     log(LOG_OK, "Slab.");
     log(LOG_END, "Memory Modules.");
     // Virtual file system
@@ -92,6 +95,8 @@ void init_kernel()
     log(LOG_START, "Process Control Module.");
     init_pc();
     log(LOG_END, "Process Control Module.");
+    // SD transfers sleep on interrupt from now on
+    init_sd_async();
     // Interrupts
     log(LOG_START, "Enable Interrupts.");
     init_interrupts();
@@ -102,6 +107,7 @@ void init_kernel()
     // Enter shell
     // pc_create(menu,"menu");
     pc_create(time_handler, "time");
+    pc_create(fs_flusher, "fs_flusher");
     //pc_create(menu,"menu");
     menu();
     //while(1);
@@ -1,4 +1,5 @@
 #include <driver/vga.h>
+#include <intr.h>
 #include <xsu/bootmm.h>
 #include <xsu/buddy.h>
 #include <xsu/list.h>
@@ -11,96 +12,43 @@ struct page* pages; // the global variable to reserve all the pages
 //???where the pointer is reserved
 struct buddy_sys buddy;
 
-/* FUNC@:add buddy element to the list
- * insert into in a decending or increasing order accoring to the freelist's level
- * if the level is 0, which represent the small memory, then, it will insert in a increasing order
- * else if the level is 1, which represent the large memory, then, it will insert in a decreasing order
+/* bit of a block in the free bitmap of its order, blocks are numbered by
+ * physical frame number >> order so a buddy is always the neighbouring bit
+ */
+#define buddy_map_word(pfn, order) (buddy.freeList[order].freeMap + (((pfn) >> (order)) >> 5))
+#define buddy_map_bit(pfn, order) (1u << (((pfn) >> (order)) & 31))
+
+/* FUNC@:add a free block to the freelist of its order
+ * freed and split blocks are pushed at the head, so the most recently used
+ * (cache-hot) block is handed out first. O(1).
  * INPUT:
- *  @para new: the pointer represent newly inserted list_node
- *  @para head: the list's head pointer
- *  @para level: the buddy list's level, decide the order
+ *  @para page: first page of the block
+ *  @para order: the block's order level
  * RETURN:
- *
  */
-void buddy_list_add(struct list_head* new, struct list_head* head, int level)
+static void buddy_list_add(struct page* page, unsigned int order)
 {
-    //FreeList's head, without value!
-    struct page* newPage;
-    //use the define to get the page
-    newPage = container_of(new, struct page, list);
-    unsigned int newPageNumber = newPage - pages;
-    if (head->prev == head) {
-        list_add(new, head);
-        return;
-    }
-    if (!level) {
-        // the lowest level---->1 page size(4KB)
-        // the relative-small memory, which we deemed it a up order based on the address
-        int flag = 0;
-        struct list_head* tempList = head->next;
-        struct list_head* endList = head->prev;
-        struct page* tmp;
-        struct page* end;
-        tmp = container_of(head->next, struct page, list);
-        end = container_of(head->prev, struct page, list);
-        while (tmp != end) {
-            // search the list to find the best place to insert into a list
-            unsigned int currentPageNumber = tmp - pages;
-            if (currentPageNumber >= newPageNumber) {
-                // find the best place to insert
-                flag = 1;
-                list_add(new, tempList->prev);
-                break;
-            }
-            tempList = tempList->next;
-            tmp = container_of(tempList, struct page, list);
-        }
-        if (!flag) {
-            // flag is represent whether find the best place,if find it,
-            // then insert into that place.
-            // if not find, then insert into the head/end of the list,
-            // according to the pagenumber
-            unsigned int currentPageNumber = end - pages;
-            if (currentPageNumber >= newPageNumber) {
-                flag = 1;
-                list_add(new, endList->prev);
-            } else {
-                flag = 1;
-                list_add(new, endList);
-            }
-        }
+    unsigned int pfn = page - pages;
 
-    } else if (level > 0) {
-        // the relative-large memory, which we deemed it a descending order based on the address
-        int flag = 0;
-        struct list_head* tempList = head->next;
-        struct list_head* endList = head->prev;
-        struct page* tmp;
-        struct page* end;
-        tmp = container_of(head->next, struct page, list);
-        end = container_of(head->prev, struct page, list);
-        while (tmp != end) {
-            // the same as before
-            unsigned int currentPageNumber = tmp - pages;
-            if (currentPageNumber <= newPageNumber) {
-                flag = 1;
-                list_add(new, tempList->prev);
-                break;
-            }
-            tempList = tempList->next;
-            tmp = container_of(tempList, struct page, list);
-        }
-        if (!flag) {
-            unsigned int currentPageNumber = end - pages;
-            if (currentPageNumber <= newPageNumber) {
-                flag = 1;
-                list_add(new, endList->prev);
-            } else {
-                flag = 1;
-                list_add(new, endList);
-            }
-        }
-    }
+    list_add(&(page->list), &(buddy.freeList[order].freeHead));
+    *buddy_map_word(pfn, order) |= buddy_map_bit(pfn, order);
+    ++buddy.freeList[order].freeNumer;
+    set_pageOrderLevel(page, order);
+    set_flag(page, _PAGE_RESERVED);
+}
+/* FUNC@:remove a free block from the freelist of its order. O(1).
+ * INPUT:
+ *  @para page: first page of the block
+ *  @para order: the block's order level
+ * RETURN:
+ */
+static void buddy_list_del(struct page* page, unsigned int order)
+{
+    unsigned int pfn = page - pages;
+
+    list_del_init(&(page->list));
+    *buddy_map_word(pfn, order) &= ~buddy_map_bit(pfn, order);
+    --buddy.freeList[order].freeNumer;
 }
 /* FUNC@:get buddy system's allocation state
  * according to the allocations state, compute the memory use state.
@@ -121,6 +69,9 @@ void get_buddy_allocation_state()
         residual += singleElementSize * (buddy.freeList[index].freeNumer);
         singleElementSize <<= 1;
     }
+    // pages cached per cpu are free as well
+    for (index = 0; index < NR_CPUS * PCP_CONTEXTS; ++index)
+        residual += 4 * buddy.pcp[index / PCP_CONTEXTS][index % PCP_CONTEXTS].count;
     kernel_printf("MemRegions: %d total, %dK residual.\n", totalMemory, residual);
 }
 /* FUNC@:get buddy system's allocation info
@@ -137,6 +88,10 @@ void buddy_info()
     for (index = 0; index <= MAX_BUDDY_ORDER; ++index) {
         kernel_printf("\t(%x)# : %x frees\n", index, buddy.freeList[index].freeNumer);
     }
+    for (index = 0; index < NR_CPUS * PCP_CONTEXTS; ++index) {
+        kernel_printf("\tcpu %x ctx %x : %x cached\n", index / PCP_CONTEXTS, index % PCP_CONTEXTS,
+            buddy.pcp[index / PCP_CONTEXTS][index % PCP_CONTEXTS].count);
+    }
 }
 /* FUNC@: this function is to init all memory with page struct
  * INPUT:
@@ -154,55 +109,32 @@ void init_pages(unsigned int startPhysicalFrameNumber, unsigned int endPhysicalF
         (pages + i)->pageCacheBlock = (void*)(-1);
         (pages + i)->pageOrderLevel = (-1); // initial state
         (pages + i)->slabFreeSpacePtr = 0; // initially, the free space is the whole page
+        (pages + i)->contigPages = 0;
         INIT_LIST_HEAD(&(pages[i].list));
     }
 }
-/* FUNC@: this function is to judge whether in the same buddy
- * Usually, it will judge two condition.
- * 1. whether the buddy page is in the same order level
- * 2. whether the buddy page has been allocated
- * the third condition is about the address match.
+/* FUNC@: this function is to judge whether a buddy block is free
+ * one bit test in the free bitmap of that order, which replaces comparing
+ * the order level and the allocation flag of the buddy's first page.
  * INPUT:
- * @para judgePage: the page which need to be judged
+ * @para buddyPfn: the first page frame number of the buddy block
  * @para pageLevel: the literal meaning
- * @para pageIndex:
  * RETURN:
  *  return value:
- * 0 represent the false, in different buddy
- * 1 represent the true, in the same buddy
+ * 0 represent the false, buddy is allocated, split or out of range
+ * 1 represent the true, buddy is a free block of the same order
  */
-int judge_in_same_buddy(struct page* judgePage, int pageLevel, int pageIndex)
+static int judge_buddy_free(unsigned int buddyPfn, unsigned int pageLevel)
 {
-    int flag = 1; // flag represent the judged result.
-    unsigned int buddyGroupIndex;
-    struct page* buddyGroupPage;
-    buddyGroupIndex = pageIndex ^ (1 << pageLevel);
-    buddyGroupPage = judgePage + (buddyGroupIndex - pageIndex);
-#ifdef BUDDY_DEBUG
-    kernel_printf("group%x %x\n", (pageIndex), buddyGroupIndex);
-#endif
-    if (!_is_same_pageOrderLevel(buddyGroupPage, pageLevel)) {
-    // condition1: judge the order level
-#ifdef BUDDY_DEBUG
-        kernel_printf("%x %x\n", buddyGroupPage->pageOrderLevel, pageOrderLevel);
-#endif
-        flag = 0;
-        return flag;
-    }
-    // original bug!!
-    if (buddyGroupPage->flag == _PAGE_ALLOCED) {
-        // condition2: judge the allocation state.
-        // another memory has been allocated.
-        flag = 0;
-        kernel_printf("the buddy memory has been allocated\n");
-        return flag;
-    }
-    return flag;
+    if (buddyPfn < buddy.buddyStartPageNumber || buddyPfn + (1 << pageLevel) > buddy.buddyEndPageNumber)
+        return 0;
+
+    return (*buddy_map_word(buddyPfn, pageLevel) & buddy_map_bit(buddyPfn, pageLevel)) != 0;
 }
 /* FUNC@: inti the buddy systemn
  * this function will initialize every buddy page.
  * the "init_pages" function will be called.
- * and the "_free_pages" function will be called.
+ * and the free memory is seeded as maximal-order blocks.
  * INPUT:
  * RETURN:
  */
@@ -211,6 +143,9 @@ void init_buddy()
     //base_page's size
     unsigned int basePageSize = sizeof(struct page);
     unsigned char* bp_base;
+    unsigned int* map;
+    unsigned int mapWords;
+    unsigned int order;
     unsigned int i;
 
     // this function is to allocate enough spaces for Page_Frame_Space
@@ -228,6 +163,20 @@ void init_buddy()
     // the user's space is start from the 0x80000000
     pages = (struct page*)((unsigned int)bp_base | 0x80000000);
 
+    // one free bitmap per order, covering all frame numbers; allocated
+    // before the end of kernel memory is taken from bootmm below
+    mapWords = 0;
+    for (i = 0; i < MAX_BUDDY_ORDER + 1; i++)
+        mapWords += ((bmm.maxPhysicalFrameNumber >> i) >> 5) + 1;
+    map = (unsigned int*)bootmm_alloc_pages(mapWords << 2, _MM_KERNEL, 1 << PAGE_SHIFT);
+    if (!map) {
+        kernel_printf("\nERROR : bootmm_alloc_pages failed!\nInit buddy system failed!\n");
+        while (1)
+            ;
+    }
+    map = (unsigned int*)((unsigned int)map | 0x80000000);
+    kernel_memset(map, 0, mapWords << 2);
+
     init_pages(0, bmm.maxPhysicalFrameNumber); //from pages[0] to pages[n]
     //initialization
     kernel_startPhysicalFrameNumber = 0;
@@ -237,43 +186,111 @@ void init_buddy()
         if (bmm.info[i].endFramePtr > kernel_endPhysicalFrameNumber)
             kernel_endPhysicalFrameNumber = bmm.info[i].endFramePtr;
     }
-    // transform to the page number
-    kernel_endPhysicalFrameNumber >>= PAGE_SHIFT;
+    // endFramePtr is the last byte in use, so the first free page is the next one
+    kernel_endPhysicalFrameNumber = (kernel_endPhysicalFrameNumber >> PAGE_SHIFT) + 1;
 
-    // page allign
-    buddy.buddyStartPageNumber = (kernel_endPhysicalFrameNumber + (1 << MAX_BUDDY_ORDER) - 1) & ~((1 << MAX_BUDDY_ORDER) - 1); // the pages that bootmm using cannot be merged into buddy_sys
-    buddy.buddyEndPageNumber = bmm.maxPhysicalFrameNumber & ~((1 << MAX_BUDDY_ORDER) - 1); // remain 2 pages for I/O
+    // blocks are aligned to their size by frame number, so buddy_sys can
+    // start right after the pages that bootmm is using
+    buddy.buddyStartPageNumber = kernel_endPhysicalFrameNumber;
+    buddy.buddyEndPageNumber = bmm.maxPhysicalFrameNumber;
     //both the start and end pfn is the page_frame_number
 
     // init FreeLists of all pageOrderLevels
     for (i = 0; i < MAX_BUDDY_ORDER + 1; i++) {
         buddy.freeList[i].freeNumer = 0;
+        buddy.freeList[i].freeMap = map;
+        map += ((bmm.maxPhysicalFrameNumber >> i) >> 5) + 1;
         INIT_LIST_HEAD(&(buddy.freeList[i].freeHead));
     }
     buddy.startPagePtr = pages + buddy.buddyStartPageNumber;
     init_lock(&(buddy.buddyLock));
+    for (i = 0; i < NR_CPUS * PCP_CONTEXTS; i++) {
+        buddy.pcp[i / PCP_CONTEXTS][i % PCP_CONTEXTS].count = 0;
+        INIT_LIST_HEAD(&(buddy.pcp[i / PCP_CONTEXTS][i % PCP_CONTEXTS].list));
+    }
 
-    // free all the page to transform the memory control to the buddy system
-    for (i = buddy.buddyStartPageNumber; i < buddy.buddyEndPageNumber; ++i) {
-        __free_pages(pages + i, 0);
+    // hand the memory to the buddy system as the largest aligned blocks that
+    // fit, instead of freeing and merging it page by page
+    i = buddy.buddyStartPageNumber;
+    while (i < buddy.buddyEndPageNumber) {
+        order = MAX_BUDDY_ORDER;
+        while (order > 0 && ((i & ((1 << order) - 1)) || i + (1 << order) > buddy.buddyEndPageNumber))
+            --order;
+        buddy_list_add(pages + i, order);
+        i += 1 << order;
     }
 }
-/* FUNC@: This function is to free the pages
- * it will call the judge_in_same_buddy function.
+/* FUNC@: This function is to give a block back to the freelists
+ * it merges the block with its buddy while the buddy is free, and will call
+ * the judge_buddy_free function. buddyLock must be held.
  * INPUT:
- *  pbpage: the first page's pointer which will be freed
- *  pageOrderLevel: the free page's order level
+ *  pbpage: the block's first page
+ *  pageOrderLevel: the block's order level
  * RETURN:
  */
-void __free_pages(struct page* pbpage, unsigned int pageOrderLevel)
+static void buddy_free_block(struct page* pbpage, unsigned int pageOrderLevel)
 {
     //pageIndex -> the current page
     //buddyGroupIndex -> the buddy group that current page is in
-
     unsigned int pageIndex;
     unsigned int buddyGroupIndex;
-    unsigned int combinedIndex, tmp;
+    unsigned int combinedIndex;
     struct page* buddyGroupPage;
+
+    pageIndex = pbpage - pages;
+    // merge with the buddy while it is a free block of the same order
+    while (pageOrderLevel < MAX_BUDDY_ORDER) {
+        buddyGroupIndex = pageIndex ^ (1 << pageOrderLevel);
+        if (!judge_buddy_free(buddyGroupIndex, pageOrderLevel))
+            break;
+        buddyGroupPage = pages + buddyGroupIndex;
+        buddy_list_del(buddyGroupPage, pageOrderLevel);
+        set_pageOrderLevel(buddyGroupPage, -1);
+        combinedIndex = buddyGroupIndex & pageIndex;
+        if (combinedIndex != pageIndex)
+            set_pageOrderLevel(pbpage, -1);
+        pbpage = pages + combinedIndex;
+        pageIndex = combinedIndex;
+        ++pageOrderLevel;
+    }
+#ifdef BUDDY_DEBUG
+    kernel_printf("final free_pageOrderLevel is: %x", pageOrderLevel);
+#endif
+    buddy_list_add(pbpage, pageOrderLevel);
+}
+/* FUNC@: This function is to give a range of pages back to the freelists
+ * the range is split into the largest aligned blocks it holds.
+ * buddyLock must be held.
+ * INPUT:
+ *  pfn: the first page frame number
+ *  count: the number of pages
+ * RETURN:
+ */
+static void buddy_free_range(unsigned int pfn, unsigned int count)
+{
+    unsigned int order;
+
+    while (count) {
+        order = MAX_BUDDY_ORDER;
+        while (order > 0 && ((pfn & ((1 << order) - 1)) || (1 << order) > count))
+            --order;
+        set_flag(pages + pfn, _PAGE_RESERVED);
+        buddy_free_block(pages + pfn, order);
+        pfn += 1 << order;
+        count -= 1 << order;
+    }
+}
+static void pcp_free_page(struct page* page);
+/* FUNC@: This function is to free the pages
+ * it will call the buddy_free_block function, single pages go to the page
+ * list of the running context.
+ * INPUT:
+ *  pbpage: the first page's pointer which will be freed
+ *  pageOrderLevel: the free page's order level
+ * RETURN:
+ */
+void __free_pages(struct page* pbpage, unsigned int pageOrderLevel)
+{
     unsigned int test = 0;
 #ifdef BUDDY_DEBUG
     kernel_printf("buddy_free.\n");
@@ -301,100 +318,185 @@ void __free_pages(struct page* pbpage, unsigned int pageOrderLevel)
     }
     kernel_printf("free_pageOrderLevel is: %x", pbpage->pageOrderLevel);
 #endif
+    if (pageOrderLevel == 0) {
+        pcp_free_page(pbpage);
+        return;
+    }
     lockup(&buddy.buddyLock);
     set_flag(pbpage, _PAGE_RESERVED);
-    pageIndex = pbpage - buddy.startPagePtr;
-    // complier do the sizeof(struct) operation, and now pageIndex is the index
-    while (pageOrderLevel < MAX_BUDDY_ORDER) {
-        if (!judge_in_same_buddy(pbpage, pageOrderLevel, pageIndex))
-            break;
-        buddyGroupIndex = pageIndex ^ (1 << pageOrderLevel);
-        buddyGroupPage = pbpage + (buddyGroupIndex - pageIndex);
-        list_del_init(&buddyGroupPage->list);
-        --buddy.freeList[pageOrderLevel].freeNumer;
-        set_pageOrderLevel(buddyGroupPage, -1);
-        combinedIndex = buddyGroupIndex & pageIndex;
-        pbpage += (combinedIndex - pageIndex);
-        pageIndex = combinedIndex;
-        ++pageOrderLevel;
-    }
-#ifdef BUDDY_DEBUG
-    if (test) {
-        kernel_printf("slab page free nearly finished!\n");
-    }
-#endif
-    set_pageOrderLevel(pbpage, pageOrderLevel);
-    //    list_add(&(pbpage->list), &(buddy.FreeList[pageOrderLevel].freeHead));
+    buddy_free_block(pbpage, pageOrderLevel);
 #ifdef BUDDY_DEBUG
-    kernel_printf("final free_pageOrderLevel is: %x", pageOrderLevel)
-#endif
-        buddy_list_add(&(pbpage->list), &(buddy.freeList[pageOrderLevel].freeHead), pageOrderLevel);
-#ifdef BUDDY_DEBUG
-    if (test) {
-        kernel_printf("slab page free nearly finished!\n");
-    }
     if (test) {
         kernel_printf("slab page free finished!\n");
     }
-    kernel_printf("v%x__addto__%x\n", &(pbpage->list),
-        &(buddy.FreeList[pageOrderLevel].freeHead));
 #endif
-    ++buddy.freeList[pageOrderLevel].freeNumer;
     unlock(&buddy.buddyLock);
 }
-/* FUNC@: This function is to allocate the pages
- * it will call the buddy_list_add function to add the extra node 
+/* FUNC@: This function is to take a block from the freelists
+ * it will call the buddy_list_add function to add the split halves.
+ * buddyLock must be held.
  * INPUT:
- *  pageOrderLevel: the free page's order level
+ *  pageOrderLevel: the block's order level
  * RETURN:
- *  return allocated page's value,
+ *  return the block's first page, 0 if no block is large enough
  */
-struct page* __alloc_pages(unsigned int pageOrderLevel)
+static struct page* buddy_alloc_block(unsigned int pageOrderLevel)
 {
     unsigned int current_order, size;
     struct page *page, *buddyPage;
     struct FreeList* free;
 
-    lockup(&buddy.buddyLock);
-
     for (current_order = pageOrderLevel; current_order <= MAX_BUDDY_ORDER; ++current_order) {
         free = buddy.freeList + current_order;
         if (!list_empty(&(free->freeHead)))
             goto found;
     }
 
-    unlock(&buddy.buddyLock);
     return 0;
 
 found:
-    // this part will judge whether allocate from the head/tail of the freelist
-    if (current_order != pageOrderLevel) {
-        // alloc from the samll part
-        page = container_of(free->freeHead.prev, struct page, list);
-
-    } else {
-        page = container_of(free->freeHead.next, struct page, list);
-    }
-    // set allocated list's state
-    list_del_init(&(page->list));
-    set_pageOrderLevel(page, pageOrderLevel);
-    set_flag(page, _PAGE_ALLOCED);
-    --(free->freeNumer);
+    page = container_of(free->freeHead.next, struct page, list);
+    buddy_list_del(page, current_order);
 
+    // the upper halves go back to the lower order freelists
     size = 1 << current_order;
     while (current_order > pageOrderLevel) {
-        --free;
         --current_order;
         size >>= 1;
         buddyPage = page + size;
-        //list_add(&(buddyPage->list), &(free->freeHead));
-        buddy_list_add(&(buddyPage->list), &(free->freeHead), current_order);
-        ++(free->freeNumer);
-        set_pageOrderLevel(buddyPage, current_order);
-        set_flag(buddyPage, _PAGE_RESERVED);
+        buddy_list_add(buddyPage, current_order);
     }
 
+    return page;
+}
+/* FUNC@: This function is to get the page list of the running context
+ * interrupt handlers use their own list. Threads share one list and may be
+ * preempted by the scheduler, so the callers mask interrupts while they
+ * change a list.
+ * INPUT:
+ * RETURN:
+ */
+static struct per_cpu_pages* pcp_current()
+{
+    return &(buddy.pcp[0][intr_depth ? 1 : 0]);
+}
+/* FUNC@: This function is to move cold pages of a page list back to buddy
+ * INPUT:
+ *  pcp: the page list
+ *  count: the number of pages to move at most
+ * RETURN:
+ */
+static void pcp_drain(struct per_cpu_pages* pcp, unsigned int count)
+{
+    struct page* page;
+    unsigned int old_ie;
+
+    old_ie = disable_interrupts();
+    lockup(&buddy.buddyLock);
+    while (count-- && pcp->count) {
+        page = container_of(pcp->list.prev, struct page, list);
+        list_del_init(&(page->list));
+        --pcp->count;
+        buddy_free_block(page, 0);
+    }
     unlock(&buddy.buddyLock);
+    if (old_ie)
+        enable_interrupts();
+}
+/* FUNC@: This function is to allocate one page from the running context's list
+ * an empty list takes PCP_BATCH pages from buddy under one lock.
+ * INPUT:
+ * RETURN:
+ *  return the page, 0 if memory is used up
+ */
+static struct page* pcp_alloc_page()
+{
+    struct per_cpu_pages* pcp;
+    struct page* page = 0;
+    unsigned int old_ie;
+
+    // A thread preempted between taking the head and unlinking it would
+    // let the next thread take the same page.
+    old_ie = disable_interrupts();
+    pcp = pcp_current();
+    if (!pcp->count) {
+        lockup(&buddy.buddyLock);
+        while (pcp->count < PCP_BATCH) {
+            page = buddy_alloc_block(0);
+            if (!page)
+                break;
+            list_add_tail(&(page->list), &(pcp->list));
+            ++pcp->count;
+        }
+        unlock(&buddy.buddyLock);
+        page = 0;
+    }
+
+    if (pcp->count) {
+        page = container_of(pcp->list.next, struct page, list);
+        list_del_init(&(page->list));
+        --pcp->count;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return page;
+}
+/* FUNC@: This function is to free one page to the running context's list
+ * the page becomes the hottest one of the list, and a full list gives
+ * PCP_BATCH cold pages back to buddy under one lock.
+ * INPUT:
+ *  page: the freed page
+ * RETURN:
+ */
+static void pcp_free_page(struct page* page)
+{
+    struct per_cpu_pages* pcp;
+    unsigned int old_ie;
+
+    set_flag(page, _PAGE_RESERVED);
+    set_pageOrderLevel(page, 0);
+    old_ie = disable_interrupts();
+    pcp = pcp_current();
+    list_add(&(page->list), &(pcp->list));
+    if (++pcp->count >= PCP_HIGH)
+        pcp_drain(pcp, PCP_BATCH);
+    if (old_ie)
+        enable_interrupts();
+}
+/* FUNC@: This function is to allocate the pages
+ * single pages come from the page list of the running context, larger
+ * blocks from the freelists. Before giving up, pages cached by the
+ * running context are given back so that they can merge.
+ * INPUT:
+ *  pageOrderLevel: the free page's order level
+ * RETURN:
+ *  return allocated page's value,
+ */
+struct page* __alloc_pages(unsigned int pageOrderLevel)
+{
+    struct page* page;
+
+    if (pageOrderLevel == 0)
+        page = pcp_alloc_page();
+    else {
+        lockup(&buddy.buddyLock);
+        page = buddy_alloc_block(pageOrderLevel);
+        unlock(&buddy.buddyLock);
+        if (!page && pcp_current()->count) {
+            pcp_drain(pcp_current(), PCP_HIGH);
+            lockup(&buddy.buddyLock);
+            page = buddy_alloc_block(pageOrderLevel);
+            unlock(&buddy.buddyLock);
+        }
+    }
+
+    if (!page)
+        return 0;
+
+    // set allocated page's state
+    set_pageOrderLevel(page, pageOrderLevel);
+    set_flag(page, _PAGE_ALLOCED);
+    page->contigPages = 0;
     return page;
 }
 /* FUNC@: This function is to allocate the pages
@@ -428,3 +530,105 @@ void free_pages(void* addr, unsigned int pageOrderLevel)
 #endif
     __free_pages(pages + ((unsigned int)addr >> PAGE_SHIFT), pageOrderLevel);
 }
+/* FUNC@: This function is to allocate a contiguous range of pages
+ * a range up to the max order is cut from the smallest block that holds it,
+ * a larger one from a run of free max-order blocks found in the free bitmap.
+ * The pages past count go straight back to the freelists.
+ * INPUT:
+ *  count: the number of pages
+ * RETURN:
+ *  return the first page of the range, 0 if no run is free
+ */
+struct page* __alloc_contig_pages(unsigned int count)
+{
+    unsigned int order, blocks, run, pfn, i;
+    struct page* page;
+
+    if (!count)
+        return 0;
+
+    if (count <= (1 << MAX_BUDDY_ORDER)) {
+        for (order = 0; (1 << order) < count; ++order)
+            ;
+        page = __alloc_pages(order);
+        if (!page)
+            return 0;
+        lockup(&buddy.buddyLock);
+        buddy_free_range(page - pages + count, (1 << order) - count);
+        goto found;
+    }
+
+    blocks = (count + (1 << MAX_BUDDY_ORDER) - 1) >> MAX_BUDDY_ORDER;
+    lockup(&buddy.buddyLock);
+    run = 0;
+    pfn = (buddy.buddyStartPageNumber + (1 << MAX_BUDDY_ORDER) - 1) & ~((1 << MAX_BUDDY_ORDER) - 1);
+    for (; pfn + (1 << MAX_BUDDY_ORDER) <= buddy.buddyEndPageNumber; pfn += 1 << MAX_BUDDY_ORDER) {
+        run = judge_buddy_free(pfn, MAX_BUDDY_ORDER) ? run + 1 : 0;
+        if (run == blocks)
+            break;
+    }
+    if (run != blocks) {
+        unlock(&buddy.buddyLock);
+        return 0;
+    }
+
+    pfn -= (blocks - 1) << MAX_BUDDY_ORDER;
+    for (i = 0; i < blocks; ++i) {
+        buddy_list_del(pages + pfn + (i << MAX_BUDDY_ORDER), MAX_BUDDY_ORDER);
+        set_pageOrderLevel(pages + pfn + (i << MAX_BUDDY_ORDER), -1);
+    }
+    page = pages + pfn;
+    buddy_free_range(pfn + count, (blocks << MAX_BUDDY_ORDER) - count);
+
+found:
+    set_pageOrderLevel(page, -1);
+    set_flag(page, _PAGE_ALLOCED);
+    page->contigPages = count;
+    unlock(&buddy.buddyLock);
+    return page;
+}
+/* FUNC@: This function is to free a contiguous range of pages
+ * INPUT:
+ *  page: the first page of the range
+ *  count: the number of pages
+ * RETURN:
+ */
+void __free_contig_pages(struct page* page, unsigned int count)
+{
+    if (!has_flag(page, _PAGE_ALLOCED)) {
+        kernel_printf("kfree_again. \n");
+        return;
+    }
+
+    lockup(&buddy.buddyLock);
+    page->contigPages = 0;
+    buddy_free_range(page - pages, count);
+    unlock(&buddy.buddyLock);
+}
+/* FUNC@: This function is to allocate a contiguous range of pages
+ * it is the exteranl interface, for buffers larger than the max order or
+ * not a power of two pages.
+ * INPUT:
+ *  count: the number of pages
+ * RETURN:
+ */
+void* alloc_contig_pages(unsigned int count)
+{
+    struct page* page = __alloc_contig_pages(count);
+
+    if (!page)
+        return 0;
+    // return the real address
+    return (void*)((page - pages) << PAGE_SHIFT);
+}
+/* FUNC@: This function is to free a contiguous range of pages
+ * it is the exteranl interface.
+ * INPUT:
+ *  addr: the free memory's address
+ *  count: the number of pages
+ * RETURN:
+ */
+void free_contig_pages(void* addr, unsigned int count)
+{
+    __free_contig_pages(pages + ((unsigned int)addr >> PAGE_SHIFT), count);
+}
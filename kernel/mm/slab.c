@@ -5,6 +5,12 @@
 
 
 #define KMEM_ADDR(PAGE, BASE) ((((PAGE) - (BASE)) << PAGE_SHIFT) | 0x80000000)
+#define SLAB_HEAD(PAGE) ((struct slab_head *)KMEM_ADDR(PAGE, pages))
+// link to the next free object, stored inside the free object
+#define SLAB_NEXT(CACHE, OBJECT) (*(void **)((unsigned char *)(OBJECT) + (CACHE)->offset))
+// first object of a slab page, right after the head at the cache's alignment
+#define SLAB_FIRST(CACHE, HEAD) \
+    ((unsigned char *)(HEAD) + ((sizeof(struct slab_head) + (CACHE)->align - 1) & ~((CACHE)->align - 1)))
 
 /*
  * one list of PAGE_SHIFT(now it's 12) possbile memory size
@@ -15,39 +21,38 @@
 struct kmem_cache kmalloc_caches[PAGE_SHIFT];
 
 static unsigned int size_kmem_cache[PAGE_SHIFT] = {96, 192, 8, 16, 32, 64, 128, 256, 512, 1024, 1536, 2048};
-/* FUNC@: This function is to judge whether the slab is free
- * this function is to search the free object's list, if find the same free object, then set the flag,
- * represent memory free. 
+static const char *name_kmem_cache[PAGE_SHIFT] = {"kmalloc-96", "kmalloc-192", "kmalloc-8", "kmalloc-16",
+    "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-1536",
+    "kmalloc-2048"};
+
+// caches of kmem_cache_create come from this one
+static struct kmem_cache kmem_cache_cache;
+// all caches, for kmem_cache_info
+static LIST_HEAD(kmem_cache_list);
+
+#ifdef SLAB_DEBUG_FREE
+/* FUNC@: This function is to flip the debug free bit of an object
  * INPUT:
- * @cache: this free slub's kmem_cache, store the relative information
- * @object: the free object's first address
+ * @cache: the object's kmem_cache
+ * @slabHeadInPage: the head of the object's page
+ * @object: the object's address
+ * @free: 1 if the object becomes free, 0 if it becomes allocated
  * RETURN:
- *  return flag value, indicated whether this slub element has been free
+ *  return 1 if the bit was already in that state, which means a double free
+ *  (or a corrupted free list)
  */
-unsigned int judge_slab_free(struct kmem_cache *cache, void *object){
-    //kernel_printf("judeg slab free condition, address is: %x", object);
-    struct page* objectPage = pages + ((unsigned int)object >> PAGE_SHIFT);
-    object = (void *)((unsigned int)object | KERNEL_ENTRY);
-    void **freeSpacePtr = objectPage->slabFreeSpacePtr;
-    unsigned int flag = 0;//not found
-    if(objectPage->flag != _PAGE_SLAB)
+static unsigned int slab_debug_mark(struct kmem_cache *cache, struct slab_head *slabHeadInPage, void *object, unsigned int free) {
+    unsigned int index = ((unsigned char *)object - SLAB_FIRST(cache, slabHeadInPage)) / cache->size;
+    unsigned int bit = 1 << (index & 31);
+    unsigned int *word = slabHeadInPage->freeMap + (index >> 5);
+
+    if (((*word & bit) != 0) == free)
         return 1;
-    *freeSpacePtr = (void *)((unsigned int)(*freeSpacePtr) | KERNEL_ENTRY);
-    while(!(is_bound((unsigned int )(*(freeSpacePtr)), 1 << PAGE_SHIFT)))
-    {
-        //kernel_printf("judge_slab_free: freeSpacePtr's value is: %x\n", *(freeSpacePtr));
-        if(*(freeSpacePtr) == object)
-        {    
-            flag = 1;
-            break;
-        }
-        freeSpacePtr = (void **)((unsigned int)*(freeSpacePtr) + cache->offset);
-    }
-    if(flag != 0)
-        return 1;//represent in the free space, which has been freed.
-    else
-        return 0;
+    *word ^= bit;
+    return 0;
 }
+#endif  // ! SLAB_DEBUG_FREE
+
 /* FUNC@:  init the struct kmem_cache_cpu
  * INPUT:
  * @kcpu: the current page used cache
@@ -55,7 +60,6 @@ unsigned int judge_slab_free(struct kmem_cache *cache, void *object){
  */
 void init_kmem_cpu(struct kmem_cache_cpu *kcpu) {
     kcpu->page = 0;
-    kcpu->cpuFreeObjectPtr = 0;
 }
 
 /* FUNC@:  init the struct kmem_cache_node
@@ -66,22 +70,61 @@ void init_kmem_cpu(struct kmem_cache_cpu *kcpu) {
 void init_kmem_node(struct kmem_cache_node *knode) {
     INIT_LIST_HEAD(&(knode->full));
     INIT_LIST_HEAD(&(knode->partial));
+    knode->partialNumber = 0;
 }
 /* FUNC@:  init every slab(10 in total)
  * every slab has a kmem_cache, when initial the slab, the cache will be initialize
+ * free objects hold the free list link in their first word, so there is no
+ * per-object overhead, unless a constructor needs the whole object kept
  * INPUT:
  * @cache: the kmem_cache_node will be inited
- * @size: 
+ * @name: the cache's name
+ * @size: the object's size
+ * @align: the object's alignment, a power of two
+ * @ctor: the object's constructor, 0 for none
  * RETURN:
+ *  return 1 if objects cannot be served, 0 otherwise
  */
-void init_each_slab(struct kmem_cache *cache, unsigned int size) {
+unsigned int init_each_slab(struct kmem_cache *cache, const char *name, unsigned int size, unsigned int align, void (*ctor)(void *)) {
+    unsigned int i;
+    unsigned int first;
+
+    if (!size || (align & (align - 1)))
+        return 1;
+    if (align < SIZE_INT)
+        align = SIZE_INT;
+
+    for (i = 0; i < 15 && name[i]; i++)
+        cache->name[i] = name[i];
+    cache->name[i] = 0;
+
     cache->objectSize = size;
     cache->objectSize += (SIZE_INT - 1);
     cache->objectSize &= ~(SIZE_INT - 1);
-    cache->size = cache->objectSize + sizeof(void *);  // add one char as mark(available)
-    cache->offset = size;
+    cache->offset = ctor ? cache->objectSize : 0;
+    cache->size = cache->offset + SIZE_INT > cache->objectSize ? cache->offset + SIZE_INT : cache->objectSize;
+    cache->size = (cache->size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->ctor = ctor;
+    cache->pageNumber = 0;
+    cache->inUse = 0;
+
+    // objects that cannot share a page are whole buddy blocks
+    first = (sizeof(struct slab_head) + align - 1) & ~(align - 1);
+    cache->objectNumber = first < (1 << PAGE_SHIFT) ? ((1 << PAGE_SHIFT) - first) / cache->size : 0;
+    cache->order = 0;
+    if (cache->objectNumber < 2) {
+        cache->objectNumber = 0;
+        while ((1 << (cache->order + PAGE_SHIFT)) < cache->objectSize || (1 << (cache->order + PAGE_SHIFT)) < align)
+            ++(cache->order);
+        if (cache->order > MAX_BUDDY_ORDER)
+            return 1;
+    }
+
     init_kmem_cpu(&(cache->cpu));
     init_kmem_node(&(cache->node));
+    list_add_tail(&(cache->list), &kmem_cache_list);
+    return 0;
 }
 /* FUNC@:  init slab system
  * this function will call the init_each_slab function
@@ -91,8 +134,9 @@ void init_each_slab(struct kmem_cache *cache, unsigned int size) {
 void init_slab() {
     unsigned int i;
 
+    init_each_slab(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache), SIZE_INT, 0);
     for (i = 0; i < PAGE_SHIFT; i++) {
-        init_each_slab(&(kmalloc_caches[i]), size_kmem_cache[i]);
+        init_each_slab(&(kmalloc_caches[i]), name_kmem_cache[i], size_kmem_cache[i], SIZE_INT, 0);
     }
 #ifdef SLAB_DEBUG
     kernel_printf("Setup Slub ok :\n");
@@ -106,115 +150,162 @@ void init_slab() {
 
 
 /* FUNC@:  format_slab_page
+ * construct all objects of a new page and link them into its free list,
+ * in address order
  * INPUT:
  * @cache: the kmem_cache_node which refer to this page
  * @page: the page needed to be format 
  * RETURN:
  */
 void format_slab_page(struct kmem_cache *cache, struct page *page) {
-    unsigned char *movingPtr = (unsigned char *)KMEM_ADDR(page, pages);  // physical addr
-    struct slab_head *slabHeadInPage = (struct slab_head *)movingPtr;
-    unsigned int *tempPtr;
-    unsigned int remaining = (1 << PAGE_SHIFT);
-    unsigned int startAddress;
-    movingPtr += (unsigned int)sizeof(struct slab_head);
-    //kernel_printf("slab_head's size is: %x\n", (unsigned int)sizeof(struct slab_head));
-
-    remaining -=  sizeof(struct slab_head);
-    startAddress = (unsigned int)movingPtr;
+    struct slab_head *slabHeadInPage = SLAB_HEAD(page);
+    unsigned char *object = SLAB_FIRST(cache, slabHeadInPage);
+    unsigned int i;
+
     set_flag(page, _PAGE_SLAB);
-    do {
-        // fotmat every slab element
-        tempPtr = (unsigned int *)(movingPtr + cache->offset);
-        movingPtr += cache->size;
-        *tempPtr = (unsigned int)movingPtr;
-        remaining -= cache->size;
-    } while (remaining >= cache->size);
-    // make the endPtr points to the tail of the linked-list
-    *tempPtr = (unsigned int)movingPtr & ~((1 << PAGE_SHIFT) - 1);
-    slabHeadInPage->listTailPtr = tempPtr;
+    page->pageCacheBlock = (void *)cache;
+    ++(cache->pageNumber);
+
+    slabHeadInPage->freeList = object;
     slabHeadInPage->allocatedNumber = 0;
+    for (i = 1; i < cache->objectNumber; i++, object += cache->size) {
+        if (cache->ctor)
+            cache->ctor(object);
+        SLAB_NEXT(cache, object) = object + cache->size;
+    }
+    if (cache->ctor)
+        cache->ctor(object);
+    SLAB_NEXT(cache, object) = 0;
+#ifdef SLAB_DEBUG_FREE
+    for (i = 0; i < SLAB_MAX_OBJECTS / 32; i++)
+        slabHeadInPage->freeMap[i] = 0xffffffff;
+#endif  // ! SLAB_DEBUG_FREE
+}
+/* FUNC@: slab_refill
+ * the current page is full: park it on the full list and continue with
+ * the first partial page, or a new page from buddy if there is none
+ * INPUT:
+ * @cache: the kmem_cache_node which tells which order of slub page should be allocated
+ * RETURN:
+ *  return the new current page
+ */
+static struct page *slab_refill(struct kmem_cache *cache) {
+    struct page *page;
+
+    if (cache->cpu.page)
+        list_add_tail(&(cache->cpu.page->list), &(cache->node.full));
+
+    if (!list_empty(&(cache->node.partial))) {
+        page = container_of(cache->node.partial.next, struct page, list);
+        list_del_init(&(page->list));
+        --(cache->node.partialNumber);
+    } else {
+        // call the buddy system to allocate one more page to be slab-cache
+        page = __alloc_pages(0);  // get pageOrderLevel = 0 page === one page
+        if (!page) {
+            // allocate failed, memory in system is used up
+            kernel_printf("ERROR: slab request one page in cache failed\n");
+            while (1)
+                ;
+        }
+#ifdef SLAB_DEBUG
+        kernel_printf("\tnew page, index: %x \n", page - pages);
+#endif  // ! SLAB_DEBUG
+        format_slab_page(cache, page);
+    }
 
     cache->cpu.page = page;
-    cache->cpu.cpuFreeObjectPtr = (void **)(&startAddress);
+    return page;
+}
+/* FUNC@: slab_alloc_block
+ * objects that take whole buddy blocks: reuse a freed one kept on the
+ * partial list, or construct a new one
+ * INPUT:
+ * @cache: the kmem_cache of the object
+ * RETURN:
+ *  return the object, 0 if memory is used up
+ */
+static void *slab_alloc_block(struct kmem_cache *cache) {
+    struct page *page;
+
+    if (!list_empty(&(cache->node.partial))) {
+        page = container_of(cache->node.partial.next, struct page, list);
+        list_del_init(&(page->list));
+        --(cache->node.partialNumber);
+        ++(cache->inUse);
+        return (void *)KMEM_ADDR(page, pages);
+    }
+
+    page = __alloc_pages(cache->order);
+    if (!page)
+        return 0;
+    set_flag(page, _PAGE_SLAB);
     page->pageCacheBlock = (void *)cache;
-    page->slabFreeSpacePtr = (cache->cpu.cpuFreeObjectPtr);
+    ++(cache->pageNumber);
+    ++(cache->inUse);
+    if (cache->ctor)
+        cache->ctor((void *)KMEM_ADDR(page, pages));
+    return (void *)KMEM_ADDR(page, pages);
+}
+/* FUNC@: slab_free_block
+ * objects that take whole buddy blocks: keep up to SLAB_MIN_PARTIAL of them
+ * for reuse, give the others back to buddy
+ * INPUT:
+ * @cache: the kmem_cache of the object
+ * @opage: the object's first page
+ * RETURN:
+ */
+static void slab_free_block(struct kmem_cache *cache, struct page *opage) {
+    // a kept object is linked on the partial list
+    if (!list_empty(&(opage->list))) {
+        kernel_printf("slab_free_failed, because it has been freed before\n");
+        return;
+    }
+
+    --(cache->inUse);
+    if (cache->node.partialNumber < SLAB_MIN_PARTIAL) {
+        list_add(&(opage->list), &(cache->node.partial));
+        ++(cache->node.partialNumber);
+        return;
+    }
+    --(cache->pageNumber);
+    __free_pages(opage, cache->order);
 }
 /* FUNC@: slab_alloc
- * allocate the slab in the cache's order
+ * pop the first free object of the current page
  * INPUT:
  * @cache: the kmem_cache_node which tells which order of slub page should be allocated
  * RETURN:
  */
 void *slab_alloc(struct kmem_cache *cache) {
+    struct page *page = cache->cpu.page;
     struct slab_head *slabHeadInPage;
-    void *object = 0;
-    struct page *newpage;
+    void *object;
 
-    if (cache->cpu.cpuFreeObjectPtr){
-        object = *(cache->cpu.cpuFreeObjectPtr);
-    }
-    //kernel_printf("slab_alloc's object is: %x\n", object);
-slalloc_check:
-    // 1st: check if the cpuFreeObjectPtr is in the boundary situation
-    if (is_bound((unsigned int)object, (1 << PAGE_SHIFT))) {
-        // 2nd: the page is full
-        if (cache->cpu.page) {
-            list_add_tail(&(cache->cpu.page->list), &(cache->node.full));
-        }
+    if (!cache->objectNumber)
+        return slab_alloc_block(cache);
 
-        if (list_empty(&(cache->node.partial))) {
-            // call the buddy system to allocate one more page to be slab-cache
-            newpage = __alloc_pages(0);  // get pageOrderLevel = 0 page === one page
-            if (!newpage) {
-                // allocate failed, memory in system is used up
-                kernel_printf("ERROR: slab request one page in cache failed\n");
-                while (1)
-                    ;
-            }
-#ifdef SLAB_DEBUG
-            kernel_printf("\tnew page, index: %x \n", newpage - pages);
-#endif  // ! SLAB_DEBUG
+    if (!page || !SLAB_HEAD(page)->freeList)
+        page = slab_refill(cache);
 
-        // using standard format to shape the new-allocated page,
-        // set the new page to be cpu.page
-            format_slab_page(cache, newpage);
-            object = *(cache->cpu.cpuFreeObjectPtr);
-            // as it's newly allocated no check may be need
-            goto slalloc_check;
-        }
-        // get the header of the cpu.page(struct page)
-
-        // This define is used to get the start pointer of a struct, if one of the member variable has been knowing, 
-        // the input variable is:
-        // tempPtr: the member variable's pointer;  type: the struct's type;   member: the member variable's name
-        // the main computing eqution is "struct's address + member variable's relative address = tempPtr"
-        // return the pointer of the struct
-        //#define container_of(tempPtr, type, member) ((type*)((char*)tempPtr - (char*)&(((type*)0)->member)))
-        cache->cpu.page = container_of(cache->node.partial.next, struct page, list);
-        list_del(cache->node.partial.next);
-        //kernel_printf("cpu.cpuFreeObjectPtr is: %x\n", cache->cpu.page->slabFreeSpacePtr);
-        cache->cpu.cpuFreeObjectPtr = cache->cpu.page->slabFreeSpacePtr;
-        object = (void *)(*(cache->cpu.cpuFreeObjectPtr));
-        //kernel_printf("cpu.page->slabFreeSpacePtr is: %x\n", object);
-        goto slalloc_check;
-    }
-slalloc_normal:
-    cache->cpu.cpuFreeObjectPtr = (void **)((unsigned char *)object + cache->offset);
-    cache->cpu.page->slabFreeSpacePtr = (cache->cpu.cpuFreeObjectPtr);
-    slabHeadInPage = (struct slab_head *)KMEM_ADDR(cache->cpu.page, pages);
+    slabHeadInPage = SLAB_HEAD(page);
+    object = slabHeadInPage->freeList;
+    slabHeadInPage->freeList = SLAB_NEXT(cache, object);
     ++(slabHeadInPage->allocatedNumber);
-slalloc_end:
-    // slab may be full after this allocation
-    if (is_bound((unsigned int )(*(cache->cpu.page->slabFreeSpacePtr)), 1 << PAGE_SHIFT)) {
-        kernel_printf("slab is full\n");
-        list_add_tail(&(cache->cpu.page->list), &(cache->node.full));
-        init_kmem_cpu(&(cache->cpu));
+    ++(cache->inUse);
+#ifdef SLAB_DEBUG_FREE
+    if (slab_debug_mark(cache, slabHeadInPage, object, 0)) {
+        kernel_printf("ERROR : slab free list corrupted at %x\n", object);
+        while (1)
+            ;
     }
+#endif  // ! SLAB_DEBUG_FREE
     return object;
 }
 /* FUNC@: slab_free
- * free the element.
+ * push the object on the free list of its page. A page that was full goes
+ * back to the partial list, a page that becomes empty goes back to buddy
+ * once the cache keeps enough partial pages.
  * INPUT:
  * @cache: the kmem_cache which tells which order of slub page should be free, 
  * and other information
@@ -222,20 +313,25 @@ slalloc_end:
  * RETURN:
  */
 void slab_free(struct kmem_cache *cache, void *object) {
-    if(judge_slab_free(cache, object)){
-        kernel_printf("slab_free_failed, because it has been freed before\n");
-        return;
-    }
     struct page *opage = pages + ((unsigned int)object >> PAGE_SHIFT);
+    struct slab_head *slabHeadInPage = SLAB_HEAD(opage);
+    void *oldFreeList;
+
+    if (!cache->objectNumber)
+        return slab_free_block(cache, opage);
+
     object = (void *)((unsigned int)object | KERNEL_ENTRY);
-    unsigned int *tempPtr;
-    struct slab_head *slabHeadInPage = (struct slab_head *)KMEM_ADDR(opage, pages);
 #ifdef SLAB_DEBUG
     kernel_printf("slab_free is : %x\n", object);
     kernel_printf("slab_head is: %x\n", slabHeadInPage);
-    kernel_printf("slab_free_1\n");
-    kernel_printf("slab_object is: %x\n", object);
 #endif
+#ifdef SLAB_DEBUG_FREE
+    if (slab_debug_mark(cache, slabHeadInPage, object, 1)) {
+        kernel_printf("slab_free_failed, because it has been freed before\n");
+        return;
+    }
+#endif  // ! SLAB_DEBUG_FREE
+
     if (!(slabHeadInPage->allocatedNumber)) {
         kernel_printf("ERROR : slab_free error!\n");
         // die();
@@ -243,57 +339,38 @@ void slab_free(struct kmem_cache *cache, void *object) {
             ;
     }
 
-    unsigned int listTailValue = *(unsigned int *)(slabHeadInPage->listTailPtr);
-    tempPtr = (unsigned int *)((unsigned char *)object + cache->offset);
-    *((unsigned int *)(slabHeadInPage->listTailPtr)) = (unsigned int)object;
-    *tempPtr = listTailValue;
-    slabHeadInPage->listTailPtr = tempPtr;
-#ifdef SLAB_DEBUG
-    kernel_printf("tempPtr is: %x\n", tempPtr);
-    kernel_printf("listTailPtr is: %x\n", slabHeadInPage->listTailPtr);
-    if(tempPtr != slabHeadInPage->listTailPtr){
-    *tempPtr = *((unsigned int *)(slabHeadInPage->listTailPtr));
-    kernel_printf("*tempPtr is: %x\n", *tempPtr);
-    }else{
-        return;
-        opage->slabFreeSpacePtr = (void**) &object;
-        // kernel_printf("")
-        kernel_printf("opage->slabFreeSpacePtr is: %x ", *(opage->slabFreeSpacePtr));
-        if(cache->cpu.page == opage)
-            cache->cpu.cpuFreeObjectPtr = opage->slabFreeSpacePtr;
-    }
-    kernel_printf("slab_free_2\n");
-#endif
+    oldFreeList = slabHeadInPage->freeList;
+    SLAB_NEXT(cache, object) = oldFreeList;
+    slabHeadInPage->freeList = object;
     --(slabHeadInPage->allocatedNumber);
-    if (list_empty(&(opage->list))){
+    --(cache->inUse);
+
+    if (opage == cache->cpu.page)
         return;
+
+    if (!oldFreeList) {
+        // page was full
+        list_del_init(&(opage->list));
+        list_add_tail(&(opage->list), &(cache->node.partial));
+        ++(cache->node.partialNumber);
     }
-    kernel_printf("slab_free successful, the address is %x\n", object);
-        
-    if (!(slabHeadInPage->allocatedNumber)) {
+
+    if (!(slabHeadInPage->allocatedNumber) && cache->node.partialNumber > SLAB_MIN_PARTIAL) {
         list_del_init(&(opage->list));
-        //kernel_printf("free the page, since all of those page has been free\n");
+        --(cache->node.partialNumber);
+        --(cache->pageNumber);
         __free_pages(opage, 0);
-        if(cache->cpu.page == opage){
-            //kernel_printf("initialize the cache_cpu\n");
-            init_kmem_cpu(&(cache->cpu));
-        }
-        //kernel_printf("slab free finished! \n");
-        return;
     }
-    //kernel_printf("slab_free_3\n");
-    list_del_init(&(opage->list));
-    list_add_tail(&(opage->list), &(cache->node.partial));
 }
 
 // find the best-fit slab system for (size)
 unsigned int get_slab(unsigned int size) {
     unsigned int i;
-    unsigned int slubSize = (1 << (PAGE_SHIFT - 1));  // half page
+    unsigned int slubSize = (1 << (PAGE_SHIFT - 1));  // half page, the largest class
     unsigned int fitIndex = PAGE_SHIFT;             // record the best fit num & index
 
     for (i = 0; i < PAGE_SHIFT; i++) {
-        if ((kmalloc_caches[i].objectSize >= size) && (kmalloc_caches[i].objectSize < slubSize)) {
+        if ((kmalloc_caches[i].objectSize >= size) && (kmalloc_caches[i].objectSize <= slubSize)) {
             slubSize = kmalloc_caches[i].objectSize;
             fitIndex = i;
         }
@@ -310,26 +387,22 @@ unsigned int get_slab(unsigned int size) {
 void *kmalloc(unsigned int size) {
     struct kmem_cache *cache;
     unsigned int fitIndex;
-    unsigned int pageOrderLevel;
+    unsigned int pageCount;
+    void *freePtr;
     if (!size)
         return 0;
 
     // if the size larger than the max size of slab system, then call buddy to
-    // solve this
+    // solve this, with exactly as many pages as needed
     if (size > kmalloc_caches[PAGE_SHIFT - 1].objectSize) {
-        size += (1 << PAGE_SHIFT) - 1;
-        size &= ~((1 << PAGE_SHIFT) - 1);    
-        pageOrderLevel = 0;
-        size = size >> (PAGE_SHIFT);
-        size -=1;
-        while(size > 0){
-            size >>= 1;
-            pageOrderLevel++;
-        }
+        pageCount = (size + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
 #ifdef SLAB_DEBUG
-        kernel_printf("pageOrderLevel is: %x\n", pageOrderLevel);
+        kernel_printf("pageCount is: %x\n", pageCount);
 #endif
-        return (void *)(KERNEL_ENTRY | (unsigned int)alloc_pages(pageOrderLevel));
+        freePtr = alloc_contig_pages(pageCount);
+        if (!freePtr)
+            return 0;
+        return (void *)(KERNEL_ENTRY | (unsigned int)freePtr);
     }
 
     fitIndex = get_slab(size);
@@ -338,7 +411,11 @@ void *kmalloc(unsigned int size) {
         while (1)
             ;
     }
-    return (void *)(KERNEL_ENTRY | (unsigned int)slab_alloc(&(kmalloc_caches[fitIndex])));
+    // classes served as whole blocks return 0 when buddy is used up
+    freePtr = slab_alloc(&(kmalloc_caches[fitIndex]));
+    if (!freePtr)
+        return 0;
+    return (void *)(KERNEL_ENTRY | (unsigned int)freePtr);
 }
 /* FUNC@: kfree
  * the external interface for the freefunction
@@ -353,8 +430,11 @@ void kfree(void *freePtr) {
 
     freePtr = (void *)((unsigned int)freePtr & (~KERNEL_ENTRY));
     page = pages + ((unsigned int)freePtr >> PAGE_SHIFT);
-    if (!(page->flag == _PAGE_SLAB))
+    if (!(page->flag == _PAGE_SLAB)) {
+        if (page->contigPages)
+            return free_contig_pages((void *)((unsigned int)freePtr & ~((1 << PAGE_SHIFT) - 1)), page->contigPages);
         return free_pages((void *)((unsigned int)freePtr & ~((1 << PAGE_SHIFT) - 1)), page->pageOrderLevel);
+    }
     //kernel_printf("slab_free\n");
     // return slab_free(page->pageCacheBlock, (void *)((unsigned int)freePtr | KERNEL_ENTRY));
     return slab_free(page->pageCacheBlock, freePtr);
@@ -369,4 +449,64 @@ void kfree(void *freePtr) {
  */
 void kmemtop(){
     get_buddy_allocation_state();
+    kmem_cache_info();
+}
+/* FUNC@: kmem_cache_create
+ * create a cache for one kind of object. Objects are packed in slab pages
+ * without the padding of the next kmalloc size class, and a freed object
+ * is handed out again as it was left.
+ * INPUT:
+ * @name: the cache's name, shown by kmemtop
+ * @size: the object's size
+ * @align: the object's alignment, a power of two, 0 for word alignment
+ * @ctor: called on each object when its memory comes from buddy, 0 for none
+ * RETURN:
+ *   return the cache, 0 if objects of this size cannot be served
+ */
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align, void (*ctor)(void *)) {
+    struct kmem_cache *cache = slab_alloc(&kmem_cache_cache);
+
+    if (!cache)
+        return 0;
+    if (init_each_slab(cache, name, size, align, ctor)) {
+        slab_free(&kmem_cache_cache, (void *)((unsigned int)cache & ~KERNEL_ENTRY));
+        return 0;
+    }
+    return cache;
+}
+/* FUNC@: kmem_cache_alloc
+ * INPUT:
+ * @cache: the cache made by kmem_cache_create
+ * RETURN:
+ *   return the object's address
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    return slab_alloc(cache);
+}
+/* FUNC@: kmem_cache_free
+ * INPUT:
+ * @cache: the cache the object comes from
+ * @freePtr: the object's address
+ * RETURN:
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *freePtr) {
+    if (!freePtr)
+        return;
+    slab_free(cache, (void *)((unsigned int)freePtr & ~KERNEL_ENTRY));
+}
+/* FUNC@: kmem_cache_info
+ * show objects and pages held by each cache, so memory of each subsystem
+ * can be told apart
+ * INPUT:
+ * RETURN:
+ */
+void kmem_cache_info() {
+    struct list_head *pos;
+    struct kmem_cache *cache;
+
+    kernel_printf("Slab caches (name, object size, in use, pages):\n");
+    list_for_each(pos, &kmem_cache_list) {
+        cache = container_of(pos, struct kmem_cache, list);
+        kernel_printf("\t%s %d %d %d\n", cache->name, cache->objectSize, cache->inUse, cache->pageNumber);
+    }
 }
@@ -18,6 +18,10 @@ struct list_head ready_list[PROC_LEVELS];
 struct list_head sleep_list;
 // The current running task
 task_struct *current;
+// Slab caches of task unions, vma nodes and page tables
+struct kmem_cache *task_union_cache;
+struct kmem_cache *vma_node_cache;
+struct kmem_cache *pgtable_cache;
 
 // Function prototypes.
 // Kill all children of father thread
@@ -155,9 +159,9 @@ static void pc_deletetask(task_struct *task)
         // Free user address space and heap
         unmap_all(task);
         // Free pagecontent
-        kfree(task->pagecontent);
+        kmem_cache_free(pgtable_cache, task->pagecontent);
     }
-    kfree(task); // Delete union
+    kmem_cache_free(task_union_cache, task); // Delete union
 }
 
 // Kill a task by it's asid
@@ -271,6 +275,10 @@ void clearasidmap()
 void init_pc()
 {
     int i;
+    // Create slab caches, task unions and page tables are page aligned
+    task_union_cache = kmem_cache_create("task_union", sizeof(task_union), 4096, 0);
+    vma_node_cache = kmem_cache_create("vma_node", sizeof(vma_node), 0, 0);
+    pgtable_cache = kmem_cache_create("pc_pgtable", 4096, 4096, 0);
     // Clear asid map
     clearasidmap();
     // Initialize all lists
@@ -310,7 +318,7 @@ void init_pc()
 task_struct *create_kthread(char *name, int level, int asfather)
 {
     // Get space
-    task_union *utask = kmalloc(sizeof(task_union));
+    task_union *utask = kmem_cache_alloc(task_union_cache);
     if (!utask)
         return (task_struct *)0;
     task_struct *task = &utask->task;
@@ -331,7 +339,7 @@ task_struct *create_kthread(char *name, int level, int asfather)
     task->ASID = getemptyasid(); //asid
     if (task->ASID == (unsigned int)-1)
     {
-        kfree(utask);
+        kmem_cache_free(task_union_cache, utask);
         return (task_struct *)0;
     }
     // Set current time
@@ -367,6 +375,7 @@ void pc_init_syscall()
     register_syscall(SYSCALL_FORK, syscall_fork);
     register_syscall(SYSCALL_SLEEP, syscall_sleep);
     register_syscall(SYSCALL_WAIT, syscall_wait);
+    register_syscall(SYSCALL_SEM_WAIT, syscall_sem_wait);
 }
 
 // wait:blocked entil task a0 ends 
@@ -462,7 +471,7 @@ void syscall_free(unsigned int status, unsigned int cause, context *pt_context)
     // Delete vma
     list_del(&vma->vma);
     // Free the space
-    kfree(vma);
+    kmem_cache_free(vma_node_cache, vma);
 }
 
 // exit: caller be killed
@@ -757,13 +766,13 @@ static int __fork_kthread(task_struct *src)
 {
     // Create new task union
     task_struct *new;
-    new = (task_struct *)kmalloc(sizeof(task_union));
+    new = (task_struct *)kmem_cache_alloc(task_union_cache);
     kernel_memcpy(new, src, sizeof(task_union));
     // Assign new asid
     new->ASID = (unsigned int)getemptyasid();
     if ((int)new->ASID == -1)
     {
-        kfree(new);
+        kmem_cache_free(task_union_cache, new);
         return -1;
     }
     // Relocate stack pointer
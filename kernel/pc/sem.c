@@ -20,6 +20,7 @@ struct semaphore* create_semaphore(char* name, int count)
     new->count = count;
     // Initalize wait list
     INIT_LIST_HEAD(&new->wait_list);
+    return new;
 }
 
 // Release semaphore
@@ -40,8 +41,16 @@ void release_semaphore(struct semaphore* sem)
 // Wait fo resource
 void sem_wait(struct semaphore* sem)
 {
-    // Disable interrupt
-    int old = disable_interrupts();
+    // Going to sleep and switching away must not be split by an interrupt,
+    // otherwise pc_schedule or sem_signal could put the task on a ready
+    // list while it is still running. So it is done inside a syscall.
+    call_syscall_a0(SYSCALL_SEM_WAIT, (int)sem);
+}
+
+// sem_wait: take semaphore a0, block until it is signaled if not available
+void syscall_sem_wait(unsigned int status, unsigned int cause, context* pt_context)
+{
+    struct semaphore* sem = (struct semaphore*)pt_context->a0;
     //decrese the count
     sem->count--;
     //if not available
@@ -51,13 +60,7 @@ void sem_wait(struct semaphore* sem)
         //go to wait list
         list_add_tail(&current->wait, &sem->wait_list);
         //run next process
-        enable_interrupts(old);
-        __request_schedule();
-    } 
-    else 
-    {
-        // Enable interrupt
-        enable_interrupts(old);
+        __pc_schedule(status, cause, pt_context);
     }
 }
 
@@ -75,8 +78,10 @@ void sem_signal(struct semaphore* sem)
         // Awake it
         list_del(sem->wait_list.next);
         // Become the next process in ready list
+        task->state = PROC_STATE_READY;
         list_add(&task->ready, &ready_list[task->level]);
     }
-    // Enable interrupt
-    enable_interrupts(old);
+    // Enable interrupt, unless it was off already (interrupt handler)
+    if (old)
+        enable_interrupts();
 }
\ No newline at end of file
@@ -28,6 +28,14 @@ static struct thread nullthread = {
 
 static struct thread* curthread = &nullthread;
 
+static struct kmem_cache* lock_cache;
+
+void synch_bootstrap(void)
+{
+    lock_cache = kmem_cache_create("lock", sizeof(struct lock), 0, 0);
+    wchan_bootstrap();
+}
+
 ////////////////////////////////////////////////////////////
 // Lock.
 ////////////////////////////////////////////////////////////
@@ -36,21 +44,21 @@ struct lock* lock_create(const char* name)
 {
     struct lock* lock;
 
-    lock = kmalloc(sizeof(struct lock));
+    lock = kmem_cache_alloc(lock_cache);
     if (lock == NULL) {
         return NULL;
     }
 
     lock->lk_name = kernel_strdup(name);
     if (lock->lk_name == NULL) {
-        kfree(lock);
+        kmem_cache_free(lock_cache, lock);
         return NULL;
     }
 
     lock->lk_wchan = wchan_create(lock->lk_name);
     if (lock->lk_wchan == NULL) {
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(lock_cache, lock);
         return NULL;
     }
 
@@ -70,7 +78,7 @@ void lock_destroy(struct lock* lock)
     if (lock->lk_wchan != NULL)
         wchan_destroy(lock->lk_wchan);
     kfree(lock->lk_name);
-    kfree(lock);
+    kmem_cache_free(lock_cache, lock);
 }
 
 void lock_acquire(struct lock* lock)
@@ -23,7 +23,7 @@ task_struct *create_process(char *name, unsigned int phy_code, unsigned int leng
     // User stack
     task->kernelflag = 0; 
     // Get user address space
-    task->pagecontent = kmalloc(4096);
+    task->pagecontent = kmem_cache_alloc(pgtable_cache);
     kernel_printf("malloc pagecontent:%x\n", task->pagecontent);
 
     // Clear page content
@@ -81,7 +81,7 @@ task_struct *create_process(char *name, unsigned int phy_code, unsigned int leng
 
 void clearpage(void *pagestart)
 {
-    kernel_memset_word(pagestart, (unsigned int)0, 1024);
+    kernel_clear_page(pagestart);
 }
 
 // Add code segment vma
@@ -95,7 +95,7 @@ void add_code_vma(struct list_head *vmahead, unsigned int pa, unsigned int lengt
             ; //invalid code address;
     }
     // Malloc vma node
-    vma_node *new = kmalloc(sizeof(vma_node));
+    vma_node *new = kmem_cache_alloc(vma_node_cache);
     // Set code vma
     new->va_start = 0;
     new->va_end = length - 1;
@@ -116,7 +116,7 @@ void add_stack_vma(struct list_head *vmahead, unsigned int pa, unsigned int leng
             ; //invalid code address;
     }
     // Malloc vma node
-    vma_node *new = kmalloc(sizeof(vma_node));
+    vma_node *new = kmem_cache_alloc(vma_node_cache);
     // Set stack vma
     new->va_start = 0x80000000 - length;
     new->va_end = new->va_start + length - 1;
@@ -137,7 +137,7 @@ int add_vma(struct list_head *vma_prev, unsigned int pa, unsigned int length)
         return 0; //beyond user space;
     }
     // Else get space
-    vma_node *new = kmalloc(sizeof(vma_node));
+    vma_node *new = kmem_cache_alloc(vma_node_cache);
     // Set vma
     new->va_start = (prev->va_end & ~(0xFFF)) + 0x1000;
     new->va_start += pa & 0xFFF;
@@ -192,7 +192,7 @@ void free_heap(task_struct *task)
         // Free space  
         kfree((void*)vma->pa);
         // Free vma_node struction     
-        kfree((void*)vma); 
+        kmem_cache_free(vma_node_cache, vma);
         pos = tmp;
     }
 }
@@ -217,7 +217,7 @@ void unmap_all(task_struct *task) //except code and stack
     {
         if (task->pagecontent[i])
         {
-            kfree(task->pagecontent[i]);
+            kmem_cache_free(pgtable_cache, task->pagecontent[i]);
         }
     }
 }
@@ -247,7 +247,7 @@ int do_mapping(unsigned int asid, vma_node *vma, TLBEntry **pagecontent)
         pgd = pagecontent[startvpn2 >> 8];
         if (pgd == 0)
         {
-            pgd = kmalloc(4096);
+            pgd = kmem_cache_alloc(pgtable_cache);
             pagecontent[startvpn2 >> 8] = pgd;
             kernel_printf("malloc pgd:%x\n", pgd);
             clearpage(pgd);
@@ -271,7 +271,7 @@ int do_mapping(unsigned int asid, vma_node *vma, TLBEntry **pagecontent)
         pgd = pagecontent[vpn2 >> 8];
         if (pgd == 0)
         {
-            pgd = kmalloc(4096);
+            pgd = kmem_cache_alloc(pgtable_cache);
             pagecontent[vpn2 >> 8] = pgd;
             kernel_printf("malloc pgd:%x\n", pgd);
             clearpage(pgd);
@@ -24,6 +24,8 @@ static struct thread nullthread = {
 
 static struct thread* curthread = &nullthread;
 
+static struct kmem_cache* wchan_cache;
+
 void thread_switch(threadstate_t newstate, struct wchan* wc) {}
 
 void thread_make_runnable(struct thread* target, bool already_have_lock) {}
@@ -32,6 +34,11 @@ void thread_make_runnable(struct thread* target, bool already_have_lock) {}
  * Wait channel functions
  */
 
+void wchan_bootstrap(void)
+{
+    wchan_cache = kmem_cache_create("wchan", sizeof(struct wchan), 0, 0);
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -44,7 +51,7 @@ struct wchan* wchan_create(const char* name)
 {
     struct wchan* wc;
 
-    wc = kmalloc(sizeof(*wc));
+    wc = kmem_cache_alloc(wchan_cache);
     if (wc == NULL) {
         return NULL;
     }
@@ -62,7 +69,7 @@ void wchan_destroy(struct wchan* wc)
 {
     cleanup_lock(&wc->wc_lock);
     threadlist_cleanup(&wc->wc_threads);
-    kfree(wc);
+    kmem_cache_free(wchan_cache, wc);
 }
 
 /*
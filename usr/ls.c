@@ -1,10 +1,15 @@
 #include <driver/vga.h>
+#include <xsu/fs/dirent.h>
 #include <xsu/fs/fat.h>
 #include <xsu/fs/vfs.h>
 #include <xsu/fs/vnode.h>
 #include <xsu/slab.h>
+#include <xsu/uio.h>
 #include <xsu/utils.h>
 
+/* Directory entries are read into this buffer in batches */
+#define LS_BUF_SIZE 4096
+
 void get_month_name(int month, char* name)
 {
     char* tmp = kmalloc(4);
@@ -52,121 +57,143 @@ void get_month_name(int month, char* name)
     kfree(tmp);
 }
 
+// Print one directory entry.
+static void ls_entry(struct dirent* d, char* options)
+{
+    if (options) {
+        if (!kernel_strcmp(options, "-a")) {
+            // Include directory entries whose names begin with a dot (.).
+            if (d->d_attr == 0x10) // sub dir
+                kernel_puts(d->d_name, VGA_GREEN, VGA_BLACK);
+            else
+                kernel_printf("%s", d->d_name);
+            kernel_printf("\t");
+        } else if (!kernel_strcmp(options, "-l")) {
+            // List in long format.
+
+            // Change data to a fix-length string.
+            // https://www.wikiwand.com/en/Design_of_the_FAT_file_system
+            // 4 * 1024 * 1024 * 1024 = 4264967396B = 4GB
+            char size[11] = "          ";
+            uint32_t file_size = d->d_size;
+            itoa(file_size, size, 10);
+            uint16_t date = d->d_date;
+            int month = (date & 0x01e0) >> 5;
+            int day = date & 0x001f;
+            char month_disp[4] = "   ";
+            get_month_name(month, month_disp);
+            char day_disp[3] = "  ";
+            itoa(day, day_disp, 2);
+            uint16_t time = d->d_time;
+            int hour = (time & 0xf800) >> 11;
+            int minute = (time & 0x07e0) >> 5;
+            char hour_disp[3] = "  ";
+            char minute_disp[3] = "  ";
+            zitoa(hour, hour_disp, 2);
+            zitoa(minute, minute_disp, 2);
+
+            // Display.
+            if (d->d_name[0] != '.') {
+                if (d->d_attr == 0x10) {
+                    kernel_printf("%s %s %s %s:%s ", size, month_disp, day_disp, hour_disp, minute_disp);
+                    kernel_puts(d->d_name, VGA_GREEN, VGA_BLACK);
+                } else {
+                    kernel_printf("%s %s %s %s:%s %s", size, month_disp, day_disp, hour_disp, minute_disp, d->d_name);
+                }
+                kernel_printf("\n");
+            }
+        } else if (!kernel_strcmp(options, "-al")) {
+            char size[11] = "          ";
+            uint32_t file_size = d->d_size;
+            itoa(file_size, size, 10);
+            uint16_t date = d->d_date;
+            int month = (date & 0x01e0) >> 5;
+            int day = date & 0x001f;
+            char month_disp[4] = "   ";
+            get_month_name(month, month_disp);
+            char day_disp[3] = "  ";
+            itoa(day, day_disp, 2);
+            uint16_t time = d->d_time;
+            int hour = (time & 0xf800) >> 11;
+            int minute = (time & 0x07e0) >> 5;
+            char hour_disp[3] = "  ";
+            char minute_disp[3] = "  ";
+            zitoa(hour, hour_disp, 2);
+            zitoa(minute, minute_disp, 2);
+
+            if (d->d_attr == 0x10) {
+                kernel_printf("%s %s %s %s:%s ", size, month_disp, day_disp, hour_disp, minute_disp);
+                kernel_puts(d->d_name, VGA_GREEN, VGA_BLACK);
+            } else {
+                kernel_printf("%s %s %s %s:%s %s", size, month_disp, day_disp, hour_disp, minute_disp, d->d_name);
+            }
+            kernel_printf("\n");
+        } else {
+            if (d->d_name[0] != '.') {
+                if (d->d_attr == 0x10) // sub dir
+                    kernel_puts(d->d_name, VGA_GREEN, VGA_BLACK);
+                else
+                    kernel_printf("%s", d->d_name);
+                kernel_printf("\t");
+            }
+        }
+    } else {
+        if (d->d_name[0] != '.') {
+            if (d->d_attr == 0x10) // sub dir
+                kernel_puts(d->d_name, VGA_GREEN, VGA_BLACK);
+            else
+                kernel_printf("%s", d->d_name);
+            kernel_printf("\t");
+        }
+    }
+}
+
 int ls(char* path, char* options)
 {
-    char newpath[256];
-    kernel_memcpy(newpath, path + 3, kernel_strlen(path) - 2);
-    assert(kernel_strlen(newpath) != 0, "path handle error.");
+    struct vnode* dir;
+    struct dirent* d;
+    struct uio uio;
+    char* buf;
+    char* p;
+    off_t pos = 0;
+    int result = 0;
+
 #ifdef VFS_DEBUG
-    kernel_printf("ls path: %s\n", newpath);
+    kernel_printf("ls path: %s\n", path);
 #endif
-    FS_FAT_DIR dir;
-    struct dir_entry_attr entry;
-    char name[32];
-    unsigned int r;
-
-    if (fs_open_dir(&dir, newpath)) {
+    if (vfs_opendir(path, &dir)) {
         kernel_printf("open dir(%s) failed : No such directory!\n", path);
         return 1;
     }
 
-readdir:
-    r = fs_read_dir(&dir, (unsigned char*)&entry);
-    if (1 != r) {
-        if (-1 == r) {
-            kernel_printf("\n");
-        } else {
-            get_filename((unsigned char*)&entry, name);
-            if (options) {
-                if (!kernel_strcmp(options, "-a")) {
-                    // Include directory entries whose names begin with a dot (.).
-                    if (entry.attr == 0x10) // sub dir
-                        kernel_puts(name, VGA_GREEN, VGA_BLACK);
-                    else
-                        kernel_printf("%s", name);
-                    kernel_printf("\t");
-                } else if (!kernel_strcmp(options, "-l")) {
-                    // List in long format.
+    buf = kmalloc(LS_BUF_SIZE);
+    if (buf == NULL) {
+        vfs_closedir(dir);
+        return 1;
+    }
 
-                    // Change data to a fix-length string.
-                    // https://www.wikiwand.com/en/Design_of_the_FAT_file_system
-                    // 4 * 1024 * 1024 * 1024 = 4264967396B = 4GB
-                    char size[11] = "          ";
-                    uint32_t file_size = entry.size;
-                    itoa(file_size, size, 10);
-                    uint16_t date = entry.date;
-                    int month = (date & 0x01e0) >> 5;
-                    int day = date & 0x001f;
-                    char month_disp[4] = "   ";
-                    get_month_name(month, month_disp);
-                    char day_disp[3] = "  ";
-                    itoa(day, day_disp, 2);
-                    uint16_t time = entry.time;
-                    int hour = (time & 0xf800) >> 11;
-                    int minute = (time & 0x07e0) >> 5;
-                    char hour_disp[3] = "  ";
-                    char minute_disp[3] = "  ";
-                    zitoa(hour, hour_disp, 2);
-                    zitoa(minute, minute_disp, 2);
+    // Each call decodes as many entries as fit in buf.
+    while (1) {
+        uio_kinit(&uio, buf, LS_BUF_SIZE, pos, UIO_READ);
+        if (VOP_GETDIRENTRY(dir, &uio)) {
+            result = 1;
+            break;
+        }
 
-                    // Display.
-                    if (name[0] != '.') {
-                        if (entry.attr == 0x10) {
-                            kernel_printf("%s %s %s %s:%s ", size, month_disp, day_disp, hour_disp, minute_disp);
-                            kernel_puts(name, VGA_GREEN, VGA_BLACK);
-                        } else {
-                            kernel_printf("%s %s %s %s:%s %s", size, month_disp, day_disp, hour_disp, minute_disp, name);
-                        }
-                        kernel_printf("\n");
-                    }
-                } else if (!kernel_strcmp(options, "-al")) {
-                    char size[11] = "          ";
-                    uint32_t file_size = entry.size;
-                    itoa(file_size, size, 10);
-                    uint16_t date = entry.date;
-                    int month = (date & 0x01e0) >> 5;
-                    int day = date & 0x001f;
-                    char month_disp[4] = "   ";
-                    get_month_name(month, month_disp);
-                    char day_disp[3] = "  ";
-                    itoa(day, day_disp, 2);
-                    uint16_t time = entry.time;
-                    int hour = (time & 0xf800) >> 11;
-                    int minute = (time & 0x07e0) >> 5;
-                    char hour_disp[3] = "  ";
-                    char minute_disp[3] = "  ";
-                    zitoa(hour, hour_disp, 2);
-                    zitoa(minute, minute_disp, 2);
+        // Nothing read, end of directory.
+        if (uio.uio_resid == LS_BUF_SIZE) {
+            kernel_printf("\n");
+            break;
+        }
 
-                    if (entry.attr == 0x10) {
-                        kernel_printf("%s %s %s %s:%s ", size, month_disp, day_disp, hour_disp, minute_disp);
-                        kernel_puts(name, VGA_GREEN, VGA_BLACK);
-                    } else {
-                        kernel_printf("%s %s %s %s:%s %s", size, month_disp, day_disp, hour_disp, minute_disp, name);
-                    }
-                    kernel_printf("\n");
-                } else {
-                    if (name[0] != '.') {
-                        if (entry.attr == 0x10) // sub dir
-                            kernel_puts(name, VGA_GREEN, VGA_BLACK);
-                        else
-                            kernel_printf("%s", name);
-                        kernel_printf("\t");
-                    }
-                }
-            } else {
-                if (name[0] != '.') {
-                    if (entry.attr == 0x10) // sub dir
-                        kernel_puts(name, VGA_GREEN, VGA_BLACK);
-                    else
-                        kernel_printf("%s", name);
-                    kernel_printf("\t");
-                }
-            }
-            goto readdir;
+        pos = uio.uio_offset;
+        for (p = buf; p < buf + LS_BUF_SIZE - uio.uio_resid; p += d->d_reclen) {
+            d = (struct dirent*)p;
+            ls_entry(d, options);
         }
-    } else {
-        return 1;
     }
-    return 0;
+
+    kfree(buf);
+    vfs_closedir(dir);
+    return result;
 }
@@ -2,6 +2,7 @@
 #include <driver/ps2.h>
 #include <driver/vga.h>
 #include <kern/errno.h>
+#include <xsu/fs/dcache.h>
 #include <xsu/fs/fat.h>
 #include <xsu/types.h>
 #include <xsu/utils.h>
@@ -80,7 +81,9 @@ void load_file(char* file_path)
 void save_file()
 {
     if (is_new_file) {
-        fs_create(filename);
+        // Bypasses VFS, so path cache is told here.
+        if (fs_create(filename) == 0)
+            dcache_drop_negative();
     }
 
     fs_open(&file, filename);
@@ -4,48 +4,141 @@
 
 /*
  * C memory functions. 
+ *
+ * Kernel is built without optimization, so they are compiled with O2 here.
+ * Once pointers are word aligned, data moves one cache line per iteration.
+ * Loop distribution is off, or GCC would turn loops into calls to memcpy.
  */
 
+#define WORD_MASK (sizeof(unsigned int) - 1)
+
+#pragma GCC push_options
+#pragma GCC optimize("O2", "no-tree-loop-distribute-patterns")
+
+// Copy word aligned block, len is a multiple of word size.
+static void kernel_copy_words(unsigned int* d, const unsigned int* s, unsigned int len)
+{
+    while (len >= KERNEL_CACHE_LINE) {
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+        d[3] = s[3];
+        d[4] = s[4];
+        d[5] = s[5];
+        d[6] = s[6];
+        d[7] = s[7];
+        d += 8;
+        s += 8;
+        len -= KERNEL_CACHE_LINE;
+    }
+
+    while (len) {
+        *d++ = *s++;
+        len -= sizeof(unsigned int);
+    }
+}
+
+// Fill word aligned block, len is a multiple of word size.
+static void kernel_fill_words(unsigned int* d, unsigned int w, unsigned int len)
+{
+    while (len >= KERNEL_CACHE_LINE) {
+        d[0] = w;
+        d[1] = w;
+        d[2] = w;
+        d[3] = w;
+        d[4] = w;
+        d[5] = w;
+        d[6] = w;
+        d[7] = w;
+        d += 8;
+        len -= KERNEL_CACHE_LINE;
+    }
+
+    while (len) {
+        *d++ = w;
+        len -= sizeof(unsigned int);
+    }
+}
+
 void* kernel_memcpy(void* dst, void* src, int len)
 {
-    char* deststr = dst;
-    char* srcstr = src;
-    while (len--) {
-        *deststr = *srcstr;
-        deststr++;
-        srcstr++;
+    unsigned char* deststr = dst;
+    const unsigned char* srcstr = src;
+    unsigned int words;
+
+    // Words can only be copied if both pointers have the same alignment.
+    if (len >= 16 && (((uintptr_t)deststr ^ (uintptr_t)srcstr) & WORD_MASK) == 0) {
+        while ((uintptr_t)deststr & WORD_MASK) {
+            *deststr++ = *srcstr++;
+            len--;
+        }
+
+        words = len & ~WORD_MASK;
+        kernel_copy_words((unsigned int*)deststr, (const unsigned int*)srcstr, words);
+        deststr += words;
+        srcstr += words;
+        len -= words;
     }
+
+    while (len-- > 0)
+        *deststr++ = *srcstr++;
+
     return dst;
 }
 
-#pragma GCC push_options
-#pragma GCC optimize("O2")
 void* kernel_memset(void* dst, int b, int len)
 {
 #ifdef MEMSET_DEBUG
-    kernel_printf("memset:%x,%x,len%x,", (int)dest, b, len);
+    kernel_printf("memset:%x,%x,len%x,", (int)dst, b, len);
 #endif // ! MEMSET_DEBUG
-    char content = b ? -1 : 0;
-    char* deststr = dst;
-    while (len--) {
-        *deststr = content;
-        deststr++;
+    unsigned char content = (unsigned char)b;
+    unsigned char* deststr = dst;
+    unsigned int words;
+
+    if (len >= 16) {
+        while ((uintptr_t)deststr & WORD_MASK) {
+            *deststr++ = content;
+            len--;
+        }
+
+        words = len & ~WORD_MASK;
+        kernel_fill_words((unsigned int*)deststr, content * 0x01010101, words);
+        deststr += words;
+        len -= words;
     }
+
+    while (len-- > 0)
+        *deststr++ = content;
 #ifdef MEMSET_DEBUG
     kernel_printf("%x\n", (int)deststr);
 #endif // ! MEMSET_DEBUG
     return dst;
 }
-#pragma GCC pop_options
 
 unsigned int* kernel_memset_word(unsigned int* dst, unsigned int w, int len)
 {
-    while (len--)
-        *dst++ = w;
+    if (len <= 0)
+        return dst;
 
-    return dst;
+    kernel_fill_words(dst, w, len << 2);
+
+    return dst + len;
 }
 
+// Clear a whole page, page must be word aligned.
+void kernel_clear_page(void* page)
+{
+    kernel_fill_words(page, 0, 1 << PAGE_SHIFT);
+}
+
+// Copy a whole page, pages must be word aligned.
+void kernel_copy_page(void* dst, void* src)
+{
+    kernel_copy_words(dst, src, 1 << PAGE_SHIFT);
+}
+
+#pragma GCC pop_options
+
 /*
  * C standard function - copy a block of memory, handling overlapping
  * regions correctly.
@@ -123,29 +216,7 @@ void* kernel_memmove(void* dst, void* src, size_t len)
  */
 void bzero(void* vblock, size_t len)
 {
-    char* block = vblock;
-    size_t i;
-
-    /*
-	 * For performance, optimize the common case where the pointer
-	 * and the length are word-aligned, and write word-at-a-time
-	 * instead of byte-at-a-time. Otherwise, write bytes.
-	 *
-	 * The alignment logic here should be portable. We rely on the
-	 * compiler to be reasonably intelligent about optimizing the
-	 * divides and modula out. Fortunately, it is.
-	 */
-
-    if ((uintptr_t)block % sizeof(long) == 0 && len % sizeof(long) == 0) {
-        long* lb = (long*)block;
-        for (i = 0; i < len / sizeof(long); i++) {
-            lb[i] = 0;
-        }
-    } else {
-        for (i = 0; i < len; i++) {
-            block[i] = 0;
-        }
-    }
+    kernel_memset(vblock, 0, len);
 }
 
 /*